@@ -1,11 +1,15 @@
-#include <string>
-#include <vector>
-#include <algorithm>
-#include <iostream>
-#include <stdexcept>
-#include <deque>
-#include <chrono>
-#include <fstream>
+#include "matching.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <cerrno>
+#endif
 
 using namespace std;
 
@@ -15,6 +19,8 @@ using namespace std;
  *      ex. AlgorithmAssignment1.exe match .\example.in .\example.out
  *  Verify mode:
  *      ex. AlgorithmAssignment1.exe verify .\example.in .\example.out
+ *  Convert mode (text instance <-> binary instance):
+ *      ex. AlgorithmAssignment1.exe convert .\example.in .\example.bin
  * 
  *  Running without arguments defaults to match with no file inputs
  *  File arguments can be replaced with * to use terminal for input/output
@@ -23,298 +29,1329 @@ using namespace std;
  *
  */
 
-struct Matching
-{
-    int hospital;
-    int student;
+// command line switches, accepted anywhere after the mode
+struct Options {
+    bool rankTable = false;     // --rank-table: precompute myRankAt before solving
+    string engine;              // --engine=sequential|parallel|rounds|interleaved (default: parallel if --threads > 1)
+    int lanes = 8;              // --lanes=K: hospitals in flight for the interleaved engine
+    string policy = "ring";     // --policy=ring|fifo|lifo|random: free-hospital order of solve()
+    bool timed = false;         // TIMED
+    string simd = "auto";       // --simd=auto|scalar|avx2|avx512: cap for the tokenizer and verifier kernels
+    bool allPairs = false;      // --all[=file]: verify lists every blocking pair
+    string allPairsFile = "*";  //   to this file ("*" for terminal)
+    unsigned threads = 1;       // --threads=N, 0 = one per hardware thread
+    bool roundStats = false;    // --round-stats: print per-round counts of the rounds engine
+    bool pipeline = false;      // --pipeline: batch parses, solves and writes on three threads
+    bool both = false;          // --both: match also computes the student-optimal matching
+    int runs = 3;               // --runs=N: repetitions averaged by bench
+    unsigned seed = 1;          // --seed=N: for instances generated by bench
+    int clients = 4;            // --clients=N: loadgen connections
+    int requests = 100;         // --requests=N: loadgen requests per connection
+    bool shm = false;           // --shm: loadgen submits through shared-memory segments
+    size_t maxRequest = 1u << 30;   // --max-request=BYTES: largest request serve accepts
 };
 
-// make vectors for preferences
-struct Instance {
-    int n = 0;
+// splits arguments into positional ones and --options; returns false on a bad option
+static bool parseArguments(int argc, char** argv, vector<string>& positional, Options& opts, string& err) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
 
-    vector<vector<int>> hospPref;
-    vector<vector<int>> studPref;
-    vector<vector<int>> studRank;
-};
+        size_t eq = arg.find('=');
+        string name = arg.substr(0, eq);
+        string value = (eq == string::npos) ? "" : arg.substr(eq + 1);
+        try {
+            if (name == "--rank-table") opts.rankTable = true;
+            else if (name == "--engine") opts.engine = value;
+            else if (name == "--threads") opts.threads = (unsigned)stoul(value);
+            else if (name == "--round-stats") opts.roundStats = true;
+            else if (name == "--pipeline") opts.pipeline = true;
+            else if (name == "--both") opts.both = true;
+            else if (name == "--clients") opts.clients = max(1, stoi(value));
+            else if (name == "--requests") opts.requests = max(1, stoi(value));
+            else if (name == "--shm") opts.shm = true;
+            else if (name == "--max-request") opts.maxRequest = (size_t)stoull(value);
+            else if (name == "--lanes") opts.lanes = max(1, stoi(value));
+            else if (name == "--policy") opts.policy = value;
+            else if (name == "--simd") opts.simd = value;
+            else if (name == "--all") {
+                opts.allPairs = true;
+                if (!value.empty()) opts.allPairsFile = value;
+            }
+            else if (name == "--runs") opts.runs = max(1, stoi(value));
+            else if (name == "--seed") opts.seed = (unsigned)stoul(value);
+            else {
+                err = "Unknown option: " + arg;
+                return false;
+            }
+        } catch (const exception&) {
+            err = "Bad value for option: " + arg;
+            return false;
+        }
+    }
+
+    if (opts.engine.empty())
+        opts.engine = (opts.threads == 1) ? "sequential" : "parallel";
+    if (opts.engine != "sequential" && opts.engine != "parallel" && opts.engine != "rounds" &&
+        opts.engine != "interleaved") {
+        err = "Unknown engine: " + opts.engine;
+        return false;
+    }
+    if (opts.policy != "ring" && opts.policy != "fifo" && opts.policy != "lifo" && opts.policy != "random") {
+        err = "Unknown policy: " + opts.policy;
+        return false;
+    }
 
-// parsing and validation helpers
-static bool isPermutation1toN(const vector<int>& line, int n) {
-    if ((int)line.size() != n) return false;
-    vector<char> seen(n + 1, 0);
-    for (int v : line) {
-        if (v < 1 || v > n) return false;
-        if (seen[v]) return false;
-        seen[v] = 1;
+    // --simd can only lower the detected level
+    SimdLevel requested = simdLevel();
+    if (opts.simd == "scalar") requested = SimdLevel::Scalar;
+    else if (opts.simd == "avx2") requested = SimdLevel::Avx2;
+    else if (opts.simd == "avx512") requested = SimdLevel::Avx512;
+    else if (opts.simd != "auto") {
+        err = "Unknown SIMD level: " + opts.simd;
+        return false;
     }
+    simdLevel() = min(simdLevel(), requested);
     return true;
 }
 
-static bool readInstance(istream& in, Instance& inst, string& err) {
-    //cout << "readInst";
-    int n;
-    if (!(in >> n)) {
-        err = "EMPTY_OR_MISSING_N";
-        return false;
+// appends "h s" lines for hospitals first..last, formatted with to_chars
+template <class Index>
+static void formatMatching(string& out, const vector<Index>& hospToStud, int first, int last) {
+    size_t size = out.size();
+    out.resize(size + (size_t)(last - first + 1) * 24);
+    char* p = &out[size];
+    for (int h = first; h <= last; h++) {
+        p = to_chars(p, p + 11, h).ptr;
+        *p++ = ' ';
+        p = to_chars(p, p + 11, (unsigned)hospToStud[h]).ptr;
+        *p++ = '\n';
     }
-    if (n < 0) {
-        err = "INVALID_N_NEGATIVE";
-        return false;
+    out.resize(p - out.data());
+}
+
+// writes the matching as "h s" lines in blocks of hospitals, one write() per block;
+// with several threads, a wave of blocks is formatted in parallel and written in order,
+// so the output is the same for any thread count
+template <class Index>
+static void writeMatching(ostream& out, const vector<Index>& hospToStud, int n, unsigned threads) {
+    const int block = 1 << 13;
+    int blocks = (n + block - 1) / block;
+    threads = (unsigned)min<long long>(resolveThreads(threads), blocks);
+    vector<string> formatted(threads);
+
+    for (int waveStart = 0; waveStart < blocks; waveStart += (int)threads) {
+        int waveBlocks = min((int)threads, blocks - waveStart);
+        runThreads((unsigned)waveBlocks, [&](unsigned id) {
+            int first = (waveStart + (int)id) * block + 1;
+            formatted[id].clear();
+            formatMatching(formatted[id], hospToStud, first, min(n, first + block - 1));
+        });
+        for (int b = 0; b < waveBlocks; b++) out.write(formatted[b].data(), (streamsize)formatted[b].size());
     }
+}
 
-    inst.n = n;
-    inst.hospPref.assign(n + 1, vector<int>(n + 1, 0));
-    inst.studPref.assign(n + 1, vector<int>(n + 1, 0));
-    inst.studRank.assign(n + 1, vector<int>(n + 1, 0));
-
-    // Hospitals
-    for (int h = 1; h <= n; h++) {
-        vector<int> line;
-        line.reserve(n);
-        for (int k = 1; k <= n; k++) {
-            int v;
-            if (!(in >> v)) {
-                err = "TRUNCATED_HOSPITAL_PREFS";
-                return false;
+// runs the engine picked by --engine (and --policy, --threads, --lanes)
+template <class Index>
+static pair<vector<Index>, long long> solveWithOptions(MatchingEngine<Index>& engine, const Options& opts,
+                                                       vector<RoundStats>* rounds = nullptr) {
+    if (opts.engine == "parallel")
+        return engine.solveParallel(opts.threads);
+    if (opts.engine == "rounds")
+        return engine.solveRounds(opts.threads, rounds);
+    if (opts.engine == "interleaved")
+        return engine.solveInterleaved(opts.lanes);
+    if (opts.policy == "fifo")
+        return engine.solve(FifoQueue());
+    if (opts.policy == "lifo")
+        return engine.solve(LifoStack());
+    if (opts.policy == "random")
+        return engine.solve(RandomOrder(opts.seed));
+    return engine.solve(RingQueue());
+}
+
+// solves inst and writes the hospital -> student pairs to file ("*" for terminal)
+// (the engine takes over inst, so only one copy of the tables exists).
+// With --both, the student-optimal matching is solved on a second thread at the same time
+// and written after a blank line; the instance has a unique stable matching exactly when
+// the two agree.
+template <class Index>
+static void runMatch(Instance<Index>& inst, const string& file, const Options& opts) {
+    int n = inst.n;
+    if (n == 0) return;
+
+    if (opts.rankTable) buildRankTable(inst);
+    MatchingEngine<Index> engine(move(inst));
+    vector<RoundStats> rounds;
+    pair<vector<Index>, long long> result, studentResult;
+    runThreads(opts.both ? 2 : 1, [&](unsigned id) {
+        if (id == 0)
+            result = solveWithOptions(engine, opts, opts.roundStats ? &rounds : nullptr);
+        else
+            studentResult = engine.solveStudentOptimal();
+    });
+    auto& hospToStud = result.first;
+
+    ofstream stream2;
+    if (file != "*")
+        stream2 = ofstream{file};
+    ostream& outputStream = (file == "*") ? cout : stream2;
+    writeMatching(outputStream, hospToStud, n, opts.threads);
+
+    if (opts.both) {
+        outputStream << "\n";
+        writeMatching(outputStream, studentResult.first, n, opts.threads);
+        outputStream.flush();
+
+        int differ = 0;
+        for (int h = 1; h <= n; h++) differ += hospToStud[h] != studentResult.first[h];
+        if (differ == 0)
+            cout << "UNIQUE STABLE MATCHING" << "\n";
+        else
+            cout << "MULTIPLE STABLE MATCHINGS: " << differ << " hospitals differ" << "\n";
+    }
+
+    if (opts.timed) {
+        cout << "Proposals: " << result.second << endl;
+        if (opts.both) cout << "Student-optimal proposals: " << studentResult.second << endl;
+    }
+
+    for (size_t r = 0; r < rounds.size(); r++) {
+        cout << "Round " << r + 1 << ": " << rounds[r].proposals << " proposals, "
+             << rounds[r].accepted << " accepted, " << rounds[r].ms << " ms" << "\n";
+    }
+}
+
+// batch mode: solves every instance of a concatenated text stream and writes each matching
+// followed by a blank line. Instances are solved on --threads workers (each with its own
+// engines, whose tables are handed back and refilled for the next instance, so they are
+// only reallocated when n grows) and written in input order through a reorder buffer.
+// For a mapped file the reader only finds where each instance ends (by counting words)
+// and the workers parse it, unless a word is not plain digits; stdin is parsed by the reader. An invalid instance is
+// reported as "INVALID: ..." and ends the batch, since the next one cannot be found.
+template <class Reader>
+static void runBatch(Reader& in, const string& file, const Options& opts) {
+    ofstream stream2;
+    if (file != "*")
+        stream2 = ofstream{file};
+    ostream& outputStream = (file == "*") ? cout : stream2;
+    BufferedWriter writer(outputStream);
+    auto begin = chrono::steady_clock::now();
+
+    // each worker solves its instances on one thread
+    unsigned threads = resolveThreads(opts.threads);
+    Options solveOpts = opts;
+    if (threads > 1) {
+        solveOpts.threads = 1;
+        if (solveOpts.engine == "parallel") solveOpts.engine = "sequential";
+    }
+    unique_ptr<ThreadPool> pool;
+    if (threads > 1) pool = make_unique<ThreadPool>(threads);
+
+    using Engines = tuple<MatchingEngine<uint16_t>, MatchingEngine<uint32_t>>;
+    vector<Engines> engines;
+    for (unsigned id = 0; id < threads; id++) engines.emplace_back(0u, 0u);
+
+    // tables of solved instances, for the reader to parse stdin instances into
+    tuple<vector<Instance<uint16_t>>, vector<Instance<uint32_t>>> spare;
+    mutex spareLock;
+
+    // reorder buffer: slot seq % size holds the result of instance seq until it is written
+    struct Result {
+        string text;
+        long long proposals = 0;
+        bool ready = false;
+        bool invalid = false;
+    };
+    vector<Result> results(4 * threads);
+    mutex resultLock;
+    condition_variable resultReady;
+    long long submitted = 0, written = 0, instances = 0, proposals = 0;
+    bool stopped = false;
+
+    // writes finished results in order, waiting until at most `pending` are left
+    auto drain = [&](long long pending) {
+        unique_lock<mutex> guard(resultLock);
+        while (!stopped && written < submitted) {
+            Result& slot = results[written % results.size()];
+            if (!slot.ready) {
+                if (submitted - written <= pending) break;
+                resultReady.wait(guard);
+                continue;
             }
-            inst.hospPref[h][k] = v;
-            line.push_back(v);
+            string text = move(slot.text);
+            slot.ready = false;
+            written++;
+            if (slot.invalid)
+                stopped = true;
+            else
+                instances++, proposals += slot.proposals;
+            guard.unlock();
+            writer.write(text);
+            guard.lock();
         }
-        if (!isPermutation1toN(line, n)) {
-            err = "INVALID_HOSPITAL_PREF_LINE_" + to_string(h);
-            return false;
+    };
+
+    // solves inst with the worker's engine and formats the result
+    auto solve = [&](auto& engine, auto&& inst, Result& result) {
+        int n = inst.n;
+        if (solveOpts.rankTable)
+            buildRankTable(inst);
+        else
+            inst.myRankAt.assign(0);
+        engine.adopt(move(inst));
+        auto solved = solveWithOptions(engine, solveOpts);
+        result.proposals = solved.second;
+        if (n > 0) formatMatching(result.text, solved.first, 1, n);
+        result.text.push_back('\n');
+    };
+
+    // runs task(worker, result) for the next instance and files its result
+    auto submit = [&](auto task) {
+        drain((long long)results.size() - 1);
+        if (stopped) return;
+        Result& slot = results[submitted++ % results.size()];
+        auto run = [&, task](unsigned id) mutable {
+            Result result;
+            task(id, result);
+            lock_guard<mutex> guard(resultLock);
+            slot = move(result);
+            slot.ready = true;
+            resultReady.notify_one();
+        };
+        if (pool)
+            pool->submit(move(run));
+        else
+            run(0);
+    };
+
+    // parses the next instance (of size n) on this thread and submits it to be solved
+    string err;
+    int n;
+    auto readAndSubmit = [&](auto index) {
+        using Index = decltype(index);
+        Instance<Index> inst;
+        {
+            lock_guard<mutex> guard(spareLock);
+            auto& tables = get<vector<Instance<Index>>>(spare);
+            if (!tables.empty()) {
+                inst = move(tables.back());
+                tables.pop_back();
+            }
         }
+        if (!readInstance(in, n, inst, err)) {
+            drain(0);
+            if (!stopped) writer.write("INVALID: " + err + "\n\n");
+            stopped = true;
+            return;
+        }
+        auto parsed = make_shared<Instance<Index>>(move(inst));
+        submit([&, parsed](unsigned id, Result& result) {
+            auto& engine = get<MatchingEngine<Index>>(engines[id]);
+            solve(engine, *parsed, result);
+            lock_guard<mutex> guard(spareLock);
+            get<vector<Instance<Index>>>(spare).push_back(engine.release());
+        });
+    };
+
+    while (!in.atEnd()) {
+        if (!readInstanceSize(in, n, err)) {
+            drain(0);
+            if (!stopped) writer.write("INVALID: " + err + "\n\n");
+            break;
+        }
+
+        withIndexType(n, [&](auto index) {
+            using Index = decltype(index);
+            if constexpr (is_same_v<Reader, BufferReader>) {
+                // the worker parses the instance's words straight into its engine's tables.
+                // An instance with any word other than plain digits may hold tokens that
+                // skip() and the parser count differently, so the reader parses it itself
+                // and the next split starts where the parser stopped.
+                const char* start = in.p;
+                bool digitsOnly;
+                in.skip(2 * (size_t)n * (size_t)n, &digitsOnly);
+                size_t size = (size_t)(in.p - start);
+                if (!digitsOnly) {
+                    in.p = start;
+                    readAndSubmit(index);
+                    return;
+                }
+                submit([&, start, size, n](unsigned id, Result& result) {
+                    auto& engine = get<MatchingEngine<Index>>(engines[id]);
+                    auto inst = engine.release();
+                    BufferReader words(start, size);
+                    string parseErr;
+                    if (readInstance(words, n, inst, parseErr)) {
+                        solve(engine, inst, result);
+                        return;
+                    }
+                    engine.adopt(move(inst));   // keeps the tables for the next instance
+                    result.text = "INVALID: " + parseErr + "\n\n";
+                    result.invalid = true;
+                });
+            } else {
+                readAndSubmit(index);
+            }
+        });
+        if (stopped) break;
     }
+    pool.reset();
+    drain(0);
+    writer.flush();
 
-    // Students
-    for (int s = 1; s <= n; s++) {
-        vector<int> line;
-        line.reserve(n);
-        for (int k = 1; k <= n; k++) {
-            int v;
-            if (!(in >> v)) {
-                err = "TRUNCATED_STUDENT_PREFS";
-                return false;
+    if (opts.timed) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        cout << "Instances: " << instances << " (" << (long long)(instances / max(seconds, 1e-9))
+             << " per second)" << "\n";
+        cout << "Proposals: " << proposals << endl;
+    }
+}
+
+// batch --pipeline: parsing, solving and writing run as three stages on their own threads,
+// connected by SpscQueues. A fixed set of jobs circulates parse -> solve -> write -> parse,
+// so each job's tables and matching are refilled rather than reallocated, and a stage
+// works on one job while its neighbours work on the previous and next ones. Output and
+// errors are those of runBatch; with TIMED, each stage's busy share of the run is printed.
+template <class Reader>
+static void runBatchPipeline(Reader& in, const string& file, const Options& opts) {
+    ofstream stream2;
+    if (file != "*")
+        stream2 = ofstream{file};
+    ostream& outputStream = (file == "*") ? cout : stream2;
+    auto begin = chrono::steady_clock::now();
+
+    struct Job {
+        int n = 0;
+        string err;     // set if the instance is invalid
+        tuple<Instance<uint16_t>, Instance<uint32_t>> inst;
+        tuple<vector<uint16_t>, vector<uint32_t>> matching;
+        long long proposals = 0;
+    };
+    const size_t JOBS = 4;
+    vector<Job> jobs(JOBS);
+    // nullptr marks the end of the stream
+    SpscQueue<Job*> parsed(JOBS), solved(JOBS), recycled(JOBS);
+    for (auto& job : jobs) recycled.push(&job);
+
+    // time each stage spent on jobs rather than waiting for one
+    chrono::steady_clock::duration parseBusy{}, solveBusy{}, writeBusy{};
+    long long instances = 0, proposals = 0;
+
+    auto take = [](SpscQueue<Job*>& queue) {
+        Job* job;
+        while (!queue.pop(job)) this_thread::yield();
+        return job;
+    };
+    auto give = [](SpscQueue<Job*>& queue, Job* job) {
+        while (!queue.push(job)) this_thread::yield();
+    };
+
+    thread parseStage([&] {
+        while (!in.atEnd()) {
+            Job* job = take(recycled);
+            auto start = chrono::steady_clock::now();
+            job->err.clear();
+            if (readInstanceSize(in, job->n, job->err)) {
+                withIndexType(job->n, [&](auto index) {
+                    readInstance(in, job->n, get<Instance<decltype(index)>>(job->inst), job->err);
+                });
             }
-            inst.studPref[s][k] = v;
-            line.push_back(v);
+            parseBusy += chrono::steady_clock::now() - start;
+            give(parsed, job);
+            if (!job->err.empty()) break;
         }
-        if (!isPermutation1toN(line, n)) {
-            err = "INVALID_STUDENT_PREF_LINE_" + to_string(s);
-            return false;
+        give(parsed, nullptr);
+    });
+
+    thread solveStage([&] {
+        tuple<MatchingEngine<uint16_t>, MatchingEngine<uint32_t>> engines{0u, 0u};
+        while (Job* job = take(parsed)) {
+            auto start = chrono::steady_clock::now();
+            if (job->err.empty()) {
+                withIndexType(job->n, [&](auto index) {
+                    using Index = decltype(index);
+                    auto& engine = get<MatchingEngine<Index>>(engines);
+                    auto& inst = get<Instance<Index>>(job->inst);
+                    if (opts.rankTable)
+                        buildRankTable(inst);
+                    else
+                        inst.myRankAt.assign(0);
+                    engine.adopt(move(inst));
+                    auto result = solveWithOptions(engine, opts);
+                    inst = engine.release();
+                    get<vector<Index>>(job->matching) = move(result.first);
+                    job->proposals = result.second;
+                });
+            }
+            solveBusy += chrono::steady_clock::now() - start;
+            give(solved, job);
         }
-        for (int k = 1; k <= n; k++) {
-            int h = inst.studPref[s][k];
-            inst.studRank[s][h] = k;
+        give(solved, nullptr);
+    });
+
+    // write stage (this thread)
+    {
+        BufferedWriter writer(outputStream);
+        string formatted;
+        bool stopped = false;
+        while (Job* job = take(solved)) {
+            auto start = chrono::steady_clock::now();
+            if (!stopped) {
+                formatted.clear();
+                if (!job->err.empty()) {
+                    formatted = "INVALID: " + job->err + "\n";
+                    stopped = true;
+                } else {
+                    withIndexType(job->n, [&](auto index) {
+                        if (job->n > 0)
+                            formatMatching(formatted, get<vector<decltype(index)>>(job->matching), 1, job->n);
+                    });
+                    instances++;
+                    proposals += job->proposals;
+                }
+                formatted.push_back('\n');
+                writer.write(formatted);
+            }
+            writeBusy += chrono::steady_clock::now() - start;
+            give(recycled, job);
         }
+        writer.flush();
+    }
+    parseStage.join();
+    solveStage.join();
+
+    if (opts.timed) {
+        auto total = chrono::steady_clock::now() - begin;
+        double seconds = chrono::duration<double>(total).count();
+        auto share = [&](chrono::steady_clock::duration busy) {
+            return (int)(100.0 * busy.count() / max<double>(1, (double)total.count()));
+        };
+        cout << "Instances: " << instances << " (" << (long long)(instances / max(seconds, 1e-9))
+             << " per second)" << "\n";
+        cout << "Proposals: " << proposals << "\n";
+        cout << "Busy: parse " << share(parseBusy) << "%, solve " << share(solveBusy)
+             << "%, write " << share(writeBusy) << "%" << endl;
+    }
+}
+
+// serve mode: requests and replies on a Unix domain socket are messages of a uint32
+// length (native byte order, like the binary format) followed by that many bytes.
+// A request starts with an op byte:
+//   'M' + instance (text or binary)                -> the matching, as match writes it
+//   'V' + uint32 instance length + instance + matching text -> the verify line
+//   'S' + shared-memory segment name (see SharedSegment) -> "OK", the matching is in the segment
+//   'C' + shared-memory segment name              -> the verify line for the matching in the segment
+//   'Q'                                           -> empty reply; the server stops accepting
+// Invalid requests get the usual "INVALID: ..." line.
+
+using ServeEngines = tuple<MatchingEngine<uint16_t>, MatchingEngine<uint32_t>>;
+
+// reads the instance in a request (text or binary) into the tables of the engine of its
+// index width, and calls fn(engine) once the engine has adopted it
+// (binary tables are viewed in place when `mapping` keeps data alive)
+template <class Fn>
+static bool withRequestInstance(const char* data, size_t size, ServeEngines& engines, bool rankTable,
+                                string& err, Fn fn, const shared_ptr<const void>& mapping = nullptr) {
+    auto load = [&](auto index, auto read) {
+        auto& engine = get<MatchingEngine<decltype(index)>>(engines);
+        auto inst = engine.release();
+        bool ok = read(inst);
+        if (ok && rankTable)
+            buildRankTable(inst);
+        else
+            inst.myRankAt.assign(0);
+        engine.adopt(move(inst));   // also keeps the tables of an invalid instance
+        if (ok) fn(engine);
+        return ok;
+    };
+
+    if (!isBinaryInstance(data, size)) {
+        BufferReader reader(data, size);
+        int n;
+        if (!readInstanceSize(reader, n, err)) return false;
+        // 2n^2 tokens take at least 4n^2 - 1 bytes; refuse an n the request cannot hold
+        // before allocating its tables
+        if ((unsigned long long)n * n > (size + 1) / 4) {
+            err = "N_EXCEEDS_REQUEST";
+            return false;
+        }
+        bool ok = false;
+        withIndexType(n, [&](auto index) {
+            ok = load(index, [&](auto& inst) { return readInstance(reader, n, inst, err); });
+        });
+        return ok;
+    }
+    BinaryHeader header;
+    if (!readBinaryHeader(data, size, header, err)) return false;
+    // the matrices are read as 2- or 4-byte entries, so an image that follows the op
+    // byte in a request is copied to an aligned buffer first (segments are page-aligned)
+    vector<uint32_t> aligned;
+    if ((uintptr_t)data % alignof(uint32_t) != 0) {
+        aligned.resize((size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+        memcpy(aligned.data(), data, size);
+        data = (const char*)aligned.data();
+    }
+    auto read = [&](auto& inst) { return loadBinaryInstance(data, header, inst, err, mapping); };
+    return (header.width == 2) ? load(uint16_t{}, read) : load(uint32_t{}, read);
+}
+
+// answers one 'M' or 'V' request with a worker's engines
+static string handleRequest(const string& request, ServeEngines& engines, const Options& opts) {
+    string err, reply;
+    const char* body = request.data() + 1;
+    size_t size = request.size() - 1;
+
+    if (request[0] == 'M') {
+        bool ok = withRequestInstance(body, size, engines, opts.rankTable, err, [&](auto& engine) {
+            auto result = solveWithOptions(engine, opts);
+            if (engine.instance().n > 0) formatMatching(reply, result.first, 1, engine.instance().n);
+        });
+        return ok ? reply : "INVALID: " + err + "\n";
     }
 
+    if (request[0] == 'V') {
+        uint32_t instanceSize;
+        if (size < sizeof(instanceSize)) return "INVALID: TRUNCATED_REQUEST\n";
+        memcpy(&instanceSize, body, sizeof(instanceSize));
+        body += sizeof(instanceSize);
+        size -= sizeof(instanceSize);
+        if (instanceSize > size) return "INVALID: TRUNCATED_REQUEST\n";
+        bool ok = withRequestInstance(body, instanceSize, engines, false, err, [&](auto& engine) {
+            BufferReader matching(body + instanceSize, size - instanceSize);
+            reply = verifyMatching(engine.instance(), readMatchingPairs(matching)) + "\n";
+        });
+        return ok ? reply : "INVALID: " + err + "\n";
+    }
+
+    return "INVALID: UNKNOWN_OP\n";
+}
+
+#ifndef _WIN32
+
+static bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = write(fd, data, size);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= (size_t)sent;
+    }
     return true;
 }
 
-// class for the Matching Engine
-class MatchingEngine
+static bool recvAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = read(fd, data, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+static bool sendMessage(int fd, const string& body) {
+    uint32_t size = (uint32_t)body.size();
+    return sendAll(fd, (const char*)&size, sizeof(size)) && sendAll(fd, body.data(), body.size());
+}
+
+// tooLarge is set (and nothing more is read) if the message is over maxSize bytes
+static bool recvMessage(int fd, string& body, size_t maxSize = UINT32_MAX, bool* tooLarge = nullptr) {
+    uint32_t size;
+    if (!recvAll(fd, (char*)&size, sizeof(size))) return false;
+    if (size > maxSize) {
+        if (tooLarge) *tooLarge = true;
+        return false;
+    }
+    body.resize(size);
+    return recvAll(fd, &body[0], size);
+}
+
+// A POSIX shared-memory segment mapped read-write, for submitting instances without
+// copying them through the socket. The layout is a binary instance image (BinaryHeader
+// and both matrices) followed by a result area of n uint32 entries, the student of each
+// hospital 1..n. The server reads the matrices in place and writes the matching there.
+class SharedSegment
 {
-    unsigned int count;
-    Instance inst;
-    
+    string segmentName;
+    char* base = nullptr;
+    size_t length = 0;
+    bool created = false;
+
 public:
+    SharedSegment() = default;
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+    ~SharedSegment() {
+        if (base) munmap(base, length);
+        if (created) shm_unlink(segmentName.c_str());
+    }
 
-    // Expected # of hospitals and students must be assigned at creation
+    // makes a new segment of `size` bytes (replacing one of the same name), removed again on destruction
+    bool create(const string& name, size_t size) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) return false;
+        created = true;
+        segmentName = name;
+        bool ok = ftruncate(fd, (off_t)size) == 0 && map(fd, size);
+        close(fd);
+        return ok;
+    }
 
-    explicit MatchingEngine(unsigned int count) : count(count) {
-        inst.n = (int)count;
-        inst.hospPref.assign(count + 1, vector<int>(count + 1, 0));
-        inst.studPref.assign(count + 1, vector<int>(count + 1, 0));
-        inst.studRank.assign(count + 1, vector<int>(count + 1, 0));
+    // maps an existing segment at its current size
+    bool open(const string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) return false;
+        segmentName = name;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0 && map(fd, (size_t)info.st_size);
+        close(fd);
+        return ok;
     }
 
-    void set_hospital_preferences(int hospital, const vector<int>& preferences) {
-        if ((unsigned)preferences.size() != count)
-            throw invalid_argument("Incorrect number of preferences (hospital).");
-        if (hospital < 1 || hospital > (int)count)
-            throw invalid_argument("Hospital id out of range.");
-        if (!isPermutation1toN(preferences, (int)count))
-            throw invalid_argument("Hospital preferences must be a permutation of 1..n.");
+    char* data() const { return base; }
+    size_t size() const { return length; }
 
-        for (int k = 1; k <= (int)count; k++)
-            inst.hospPref[hospital][k] = preferences[k - 1];
+    // offset of the result area of a segment holding this header's instance
+    static size_t resultOffset(const BinaryHeader& header) {
+        return sizeof(header) + 2 * (size_t)header.n * header.n * header.width;
     }
 
-    void set_student_preferences(int student, const vector<int>& preferences) {
-        if ((unsigned)preferences.size() != count)
-            throw invalid_argument("Incorrect number of preferences (student).");
-        if (student < 1 || student > (int)count)
-            throw invalid_argument("Student id out of range.");
-        if (!isPermutation1toN(preferences, (int)count))
-            throw invalid_argument("Student preferences must be a permutation of 1..n.");
+private:
+    bool map(int fd, size_t size) {
+        if (size == 0) return false;
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        base = (char*)mapped;
+        length = size;
+        return true;
+    }
+};
 
-        for (int k = 1; k <= (int)count; k++) {
-            int h = preferences[k - 1];
-            inst.studPref[student][k] = h;
-            inst.studRank[student][h] = k;
+// answers an 'S' (solve) or 'C' (check) request for the instance in a shared-memory segment
+static string handleSegmentRequest(const string& request, ServeEngines& engines, const Options& opts) {
+    auto segment = make_shared<SharedSegment>();
+    if (!segment->open(request.substr(1))) return "INVALID: SEGMENT_NOT_FOUND\n";
+    if (!isBinaryInstance(segment->data(), segment->size())) return "INVALID: SEGMENT_NOT_BINARY\n";
+    string err, reply;
+    BinaryHeader header;
+    if (!readBinaryHeader(segment->data(), segment->size(), header, err)) return "INVALID: " + err + "\n";
+    size_t offset = SharedSegment::resultOffset(header);
+    if (segment->size() - offset < (size_t)header.n * sizeof(uint32_t)) return "INVALID: SEGMENT_TRUNCATED_RESULT\n";
+    uint32_t* studentOf = (uint32_t*)(segment->data() + offset);
+
+    bool check = request[0] == 'C';
+    bool ok = withRequestInstance(segment->data(), offset, engines, opts.rankTable && !check, err, [&](auto& engine) {
+        int n = engine.instance().n;
+        if (check) {
+            vector<pair<int,int>> pairs(n);
+            for (int h = 1; h <= n; h++) pairs[h - 1] = {h, (int)studentOf[h - 1]};
+            reply = verifyMatching(engine.instance(), pairs) + "\n";
+            return;
         }
-    }
+        auto result = solveWithOptions(engine, opts);
+        for (int h = 1; h <= n; h++) studentOf[h - 1] = result.first[h];
+        reply = "OK\n";
+    }, segment);
+    dropBorrowedTables(get<0>(engines));
+    dropBorrowedTables(get<1>(engines));
+    return ok ? reply : "INVALID: " + err + "\n";
+}
 
-    // new solve() approach
-    // returns hospital -> student mapping (1-indexed) and proposal count
-    pair<vector<int>, long long> solve() {
-        deque<int> unmatched_hospitals;
-        vector<int> next_choices(count + 1, 1);
-        vector<int> student_matches(count + 1, 0);
-        vector<int> hospital_matches(count + 1, 0);
+// fills addr for a socket path; false if the path does not fit
+static bool socketAddress(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
 
-        for (int h = 1; h <= (int)count; h++)
-            unmatched_hospitals.push_back(h);
+// serve mode: accepts connections on a Unix domain socket, one (detached) thread per connection,
+// and solves or verifies their requests on a pool of --threads workers, each with its
+// own engines whose tables are reused from request to request
+static int runServe(const string& path, const Options& opts) {
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) {
+        cerr << "Invalid socket path: " << path << endl;
+        return 1;
+    }
+    // a socket left behind by an earlier server is replaced; any other file is not
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
 
-        long long proposals = 0;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        cerr << "Cannot listen on " << path << ": " << strerror(errno) << endl;
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+    cout << "Serving on " << path << endl;
+
+    // the engines are declared first so the pool joins its workers before they go
+    unsigned workers = resolveThreads(opts.threads);
+    vector<ServeEngines> engines;
+    for (unsigned id = 0; id < workers; id++) engines.emplace_back(0u, 0u);
+    ThreadPool pool(workers);
+    atomic<bool> stopping(false);
 
-        while (!unmatched_hospitals.empty()) {
-            int hospital = unmatched_hospitals.front();
+    // connection threads are detached so each one's resources go as soon as its client
+    // leaves; shutdown waits for the live ones, which use the pool and engines above
+    mutex connectionLock;
+    condition_variable connectionsDone;
+    int liveConnections = 0;
 
-            // in case of bad input (shouldn’t happen with complete lists)
-            if (next_choices[hospital] > (int)count) {
-                unmatched_hospitals.pop_front();
+    auto serveConnection = [&](int fd) {
+        string request;
+        bool tooLarge = false;
+        while (recvMessage(fd, request, opts.maxRequest, &tooLarge)) {
+            if (request.empty()) {
+                if (!sendMessage(fd, "INVALID: EMPTY_REQUEST\n")) break;
                 continue;
             }
+            if (request[0] == 'Q') {
+                sendMessage(fd, "");
+                stopping = true;
+                shutdown(listener, SHUT_RDWR);
+                break;
+            }
+            promise<string> reply;
+            pool.submit([&](unsigned id) {
+                bool segment = request[0] == 'S' || request[0] == 'C';
+                string text;
+                {
+                    // the worker's engines drop whatever they still view (even if the
+                    // request threw) before the reply is set: once it is, the server may
+                    // shut down
+                    struct DropViews {
+                        ServeEngines& engines;
+                        ~DropViews() {
+                            dropBorrowedTables(get<0>(engines));
+                            dropBorrowedTables(get<1>(engines));
+                        }
+                    } drop{engines[id]};
 
-            int student = inst.hospPref[hospital][next_choices[hospital]];
-            next_choices[hospital]++;
-            proposals++;
+                    // a request that fails is answered like an invalid one
+                    try {
+                        text = segment ? handleSegmentRequest(request, engines[id], opts)
+                                       : handleRequest(request, engines[id], opts);
+                    } catch (const bad_alloc&) {
+                        text = "INVALID: OUT_OF_MEMORY\n";
+                    } catch (const exception&) {
+                        text = "INVALID: REQUEST_FAILED\n";
+                    }
+                }
+                reply.set_value(move(text));
+            });
+            if (!sendMessage(fd, reply.get_future().get())) break;
+        }
+        // the rest of an oversized message is not read, so the connection ends with it
+        if (tooLarge) sendMessage(fd, "INVALID: REQUEST_TOO_LARGE\n");
+        close(fd);
+    };
 
-            if (student_matches[student] == 0) {
-                // student free -> match
-                student_matches[student] = hospital;
-                hospital_matches[hospital] = student;
-                unmatched_hospitals.pop_front();
-            } else {
-                int prev_hospital = student_matches[student];
+    while (!stopping) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR && !stopping) continue;
+            break;
+        }
+        {
+            lock_guard<mutex> guard(connectionLock);
+            liveConnections++;
+        }
+        try {
+            thread([&, fd] {
+                serveConnection(fd);
+                lock_guard<mutex> guard(connectionLock);
+                if (--liveConnections == 0) connectionsDone.notify_all();
+            }).detach();
+        } catch (const system_error&) {
+            // no thread for this client: turn it away and keep accepting
+            close(fd);
+            lock_guard<mutex> guard(connectionLock);
+            liveConnections--;
+        }
+    }
+    {
+        unique_lock<mutex> guard(connectionLock);
+        connectionsDone.wait(guard, [&] { return liveConnections == 0; });
+    }
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
 
-                // student prefers lower rank
-                if (inst.studRank[student][hospital] < inst.studRank[student][prev_hospital]) {
-                    // student switches
-                    student_matches[student] = hospital;
-                    hospital_matches[hospital] = student;
+// loadgen mode: --clients connections each send --requests match requests for one
+// instance file to a server and time them; prints throughput and latency percentiles.
+// With --shm, each client writes the instance once into its own shared-memory segment
+// and its requests only name the segment.
+static int runLoadgen(const string& path, const string& file, const Options& opts) {
+    signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) {
+        cerr << "Invalid socket path: " << path << endl;
+        return 1;
+    }
 
-                    hospital_matches[prev_hospital] = 0;
+    vector<string> requests(opts.clients);
+    vector<unique_ptr<SharedSegment>> segments;
+    if (!opts.shm) {
+        MappedFile mapped;
+        mapped.open(file);
+        for (auto& request : requests) request = "M" + string(mapped.data(), mapped.size());
+    } else {
+        string image, err;
+        int n = 0;
+        bool loaded = withInstance(file, err, [&](auto& inst) {
+            ostringstream out;
+            writeBinaryInstance(out, inst);
+            image = out.str();
+            n = inst.n;
+        });
+        if (!loaded) {
+            cerr << file << ": INVALID: " << err << endl;
+            return 1;
+        }
+        for (int id = 0; id < opts.clients; id++) {
+            string name = "/matching-" + to_string(getpid()) + "-" + to_string(id);
+            segments.push_back(make_unique<SharedSegment>());
+            if (!segments.back()->create(name, image.size() + (size_t)n * sizeof(uint32_t))) {
+                cerr << "Cannot create shared memory segment " << name << ": " << strerror(errno) << endl;
+                return 1;
+            }
+            memcpy(segments.back()->data(), image.data(), image.size());
+            requests[id] = "S" + name;
+        }
+    }
 
-                    unmatched_hospitals.pop_front();
-                    unmatched_hospitals.push_back(prev_hospital);
-                }
-                // else rejected; hospital stays unmatched and tries again later
+    vector<vector<double>> latencies(opts.clients);
+    atomic<long long> invalid(0), failed(0);
+    auto begin = chrono::steady_clock::now();
+    runThreads((unsigned)opts.clients, [&](unsigned id) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            failed += opts.requests;
+            if (fd >= 0) close(fd);
+            return;
+        }
+        string reply;
+        for (int r = 0; r < opts.requests; r++) {
+            auto start = chrono::steady_clock::now();
+            if (!sendMessage(fd, requests[id]) || !recvMessage(fd, reply)) {
+                failed += opts.requests - r;
+                break;
             }
+            latencies[id].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            if (reply.rfind("INVALID", 0) == 0) invalid++;
         }
+        close(fd);
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    vector<double> all;
+    for (auto& client : latencies) all.insert(all.end(), client.begin(), client.end());
+    sort(all.begin(), all.end());
+    auto percentile = [&](double q) { return all.empty() ? 0.0 : all[min(all.size() - 1, (size_t)(q * all.size()))]; };
+
+    cout << "Requests: " << all.size() << " from " << opts.clients << " clients in " << fixed << setprecision(3)
+         << seconds << " s (" << setprecision(0) << all.size() / max(seconds, 1e-9) << " per second)\n";
+    cout << "Latency: p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us, max "
+         << (all.empty() ? 0.0 : all.back()) << " us\n";
+    cout.unsetf(ios::floatfield);
+    if (invalid) cout << "Invalid replies: " << invalid << "\n";
+    if (failed) cout << "Failed requests: " << failed << "\n";
+    return failed ? 1 : 0;
+}
+
+#else
 
-        return {hospital_matches, proposals};
+static int runServe(const string&, const Options&) {
+    cerr << "serve needs Unix domain sockets (POSIX only)" << endl;
+    return 1;
+}
+
+static int runLoadgen(const string&, const string&, const Options&) {
+    cerr << "loadgen needs Unix domain sockets (POSIX only)" << endl;
+    return 1;
+}
+
+#endif
+
+// random complete preference lists (same shape as scalability/gen_file.py output)
+template <class Index>
+static Instance<Index> randomInstance(int n, unsigned seed) {
+    mt19937 rng(seed);
+    Instance<Index> inst;
+    inst.n = n;
+    inst.hospPref.assign(n);
+    inst.studPref.assign(n);
+    inst.studRank.assign(n);
+    for (int i = 1; i <= n; i++) {
+        auto h = inst.hospPref[i];
+        auto s = inst.studPref[i];
+        for (int k = 1; k <= n; k++) h[k] = s[k] = (Index)k;
+        shuffle(h.begin(), h.end(), rng);
+        shuffle(s.begin(), s.end(), rng);
+        for (int k = 1; k <= n; k++) inst.studRank[i][s[k]] = (Index)k;
     }
+    return inst;
+}
 
-};
+// bench inputs are instance files, or a bare number n for a random n x n instance
+template <class Fn>
+static bool withBenchInstance(const string& input, const Options& opts, string& err, Fn fn) {
+    if (!input.empty() && all_of(input.begin(), input.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        int n = stoi(input);
+        withIndexType(n, [&](auto index) {
+            auto inst = randomInstance<decltype(index)>(n, opts.seed);
+            fn(inst);
+        });
+        return true;
+    }
+    return withInstance(input, err, fn, nullptr, opts.threads);
+}
 
-// Verifier (done as a separate mode rather than a separate program. could be changed later)
-static string verifyMatching(const Instance& inst, const vector<pair<int,int>>& pairs) {
-    int n = inst.n;
-    if ((int)pairs.size() != n) {
-        return "INVALID: expected " + to_string(n) + " matching lines, got " + to_string(pairs.size());
-    }
-
-    vector<int> hospToStud(n + 1, 0), studToHosp(n + 1, 0);
-    vector<char> seenHosp(n + 1, 0), seenStud(n + 1, 0);
-
-    // validity
-    for (auto [h, s] : pairs) {
-        if (h < 1 || h > n || s < 1 || s > n)
-            return "INVALID: out-of-range pair (" + to_string(h) + "," + to_string(s) + ")";
-        if (seenHosp[h]) return "INVALID: hospital " + to_string(h) + " appears more than once";
-        if (seenStud[s]) return "INVALID: student " + to_string(s) + " appears more than once";
-        seenHosp[h] = 1; seenStud[s] = 1;
-        hospToStud[h] = s;
-        studToHosp[s] = h;
-    }
-    for (int h = 1; h <= n; h++) if (!seenHosp[h]) return "INVALID: hospital " + to_string(h) + " is unmatched";
-    for (int s = 1; s <= n; s++) if (!seenStud[s]) return "INVALID: student " + to_string(s) + " is unmatched";
-
-    // hospital ranks
-    vector<vector<int>> hospRank(n + 1, vector<int>(n + 1, 0));
-    for (int h = 1; h <= n; h++)
-        for (int k = 1; k <= n; k++)
-            hospRank[h][inst.hospPref[h][k]] = k;
-
-    // stability (blocking pair)
-    for (int h = 1; h <= n; h++) {
-        int sMatched = hospToStud[h];
-        int rankMatched = hospRank[h][sMatched];
-
-        for (int k = 1; k < rankMatched; k++) {
-            int s = inst.hospPref[h][k];
-            int hMatchedToS = studToHosp[s];
-            if (inst.studRank[s][h] < inst.studRank[s][hMatchedToS]) {
-                return "UNSTABLE: blocking pair (hospital " + to_string(h) + ", student " + to_string(s) + ")";
-            }
-        }
+// average wall time of fn over opts.runs runs, in ms
+template <class Fn>
+static double averageMs(const Options& opts, Fn fn) {
+    double total = 0;
+    for (int r = 0; r < opts.runs; r++) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        total += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
     }
+    return total / opts.runs;
+}
+
+// bench rank-table: solve() on studRank vs. on the precomputed myRankAt table
+template <class Index>
+static void benchRankTable(const string& name, Instance<Index>& inst, const Options& opts) {
+    Instance<Index> ranked = inst;
+    double buildMs = averageMs(opts, [&] { buildRankTable(ranked); });
+
+    MatchingEngine<Index> plain(move(inst)), withTable(move(ranked));
+    long long proposals = 0;
+    double plainMs = averageMs(opts, [&] { proposals = plain.solve().second; });
+    double tableMs = averageMs(opts, [&] { withTable.solve(); });
+
+    cout << left << setw(28) << name << right << setw(8) << plain.instance().n
+         << setw(14) << proposals << fixed << setprecision(3)
+         << setw(12) << plainMs << setw(12) << buildMs << setw(12) << tableMs
+         << setw(10) << setprecision(2) << plainMs / tableMs << "x\n";
+    cout.unsetf(ios::floatfield);
+}
+
+// bench rounds: round count and cost of the round-synchronous engine vs. solve()
+template <class Index>
+static void benchRounds(const string& name, Instance<Index>& inst, const Options& opts) {
+    if (opts.rankTable) buildRankTable(inst);
+    MatchingEngine<Index> engine(move(inst));
+    long long proposals = 0;
+    size_t rounds = 0;
+    double solveMs = averageMs(opts, [&] { engine.solve(); });
+    double roundsMs = averageMs(opts, [&] {
+        vector<RoundStats> stats;
+        proposals = engine.solveRounds(opts.threads, &stats).second;
+        rounds = stats.size();
+    });
+
+    cout << left << setw(28) << name << right << setw(8) << engine.instance().n
+         << setw(14) << proposals << setw(10) << rounds << fixed << setprecision(3)
+         << setw(12) << solveMs << setw(12) << roundsMs << "\n";
+    cout.unsetf(ios::floatfield);
+}
+
+// bench prefetch: proposals per second of solve() vs. the interleaved engine
+template <class Index>
+static void benchPrefetch(const string& name, Instance<Index>& inst, const Options& opts) {
+    if (opts.rankTable) buildRankTable(inst);
+    MatchingEngine<Index> engine(move(inst));
+    long long dequeProposals = 0, laneProposals = 0;
+    double dequeMs = averageMs(opts, [&] { dequeProposals = engine.solve().second; });
+    double laneMs = averageMs(opts, [&] { laneProposals = engine.solveInterleaved(opts.lanes).second; });
 
-    return "VALID STABLE";
+    cout << left << setw(28) << name << right << setw(8) << engine.instance().n
+         << setw(14) << dequeProposals << fixed << setprecision(3)
+         << setw(12) << dequeMs << setw(12) << laneMs << setprecision(2)
+         << setw(14) << dequeProposals / dequeMs / 1000 << setw(14) << laneProposals / laneMs / 1000
+         << setw(10) << dequeMs / laneMs << "x\n";
+    cout.unsetf(ios::floatfield);
 }
 
-static vector<pair<int,int>> readMatchingPairs(istream& in) {
+// bench policy: proposal count and solve() time under each scheduling policy
+template <class Index>
+static void benchPolicy(const string& name, Instance<Index>& inst, const Options& opts) {
+    if (opts.rankTable) buildRankTable(inst);
+    MatchingEngine<Index> engine(move(inst));
+
+    auto run = [&](auto schedule) {
+        long long proposals = 0;
+        double ms = averageMs(opts, [&] { proposals = engine.solve(schedule).second; });
+        cout << left << setw(28) << name << right << setw(8) << engine.instance().n
+             << setw(14) << proposals << setw(10) << schedule.name()
+             << fixed << setprecision(3) << setw(12) << ms << "\n";
+        cout.unsetf(ios::floatfield);
+    };
+    run(RingQueue());
+    run(FifoQueue());
+    run(LifoStack());
+    run(RandomOrder(opts.seed));
+}
+
+// output stream that throws everything away (for timing writers without disk I/O)
+class NullBuffer : public streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+// a random perfect matching (usually far from stable) for the verifier benchmarks
+static vector<pair<int,int>> randomMatching(int n, unsigned seed) {
+    mt19937 rng(seed);
+    vector<int> students(n);
+    for (int i = 0; i < n; i++) students[i] = i + 1;
+    shuffle(students.begin(), students.end(), rng);
     vector<pair<int,int>> pairs;
-    int h, s;
-    while (in >> h >> s) pairs.push_back({h, s});
+    for (int h = 1; h <= n; h++) pairs.push_back({h, students[h - 1]});
     return pairs;
 }
 
+// bench verify-all: blocking-pair enumeration throughput against a random matching
+template <class Index>
+static void benchVerifyAll(const string& name, Instance<Index>& inst, const Options& opts) {
+    auto pairs = randomMatching(inst.n, opts.seed);
+    NullBuffer discard;
+    ostream sink(&discard);
+    long long blocking = 0;
+    double ms = averageMs(opts, [&] { blocking = verifyAllBlockingPairs(inst, pairs, opts.threads, sink, sink); });
+
+    cout << left << setw(28) << name << right << setw(8) << inst.n
+         << setw(14) << blocking << fixed << setprecision(3) << setw(12) << ms
+         << setprecision(2) << setw(12) << blocking / ms / 1000 << "\n";
+    cout.unsetf(ios::floatfield);
+}
+
+// bench verify-simd: full blocking-pair scan (no early exit) with each available kernel.
+// Verifies the student-optimal matching, which is stable but leaves hospitals far down
+// their lists, so the prefixes are long; it is found by solving with the sides swapped.
+template <class Index>
+static void benchVerifySimd(const string& name, Instance<Index>& inst, const Options& opts) {
+    vector<pair<int,int>> pairs;
+    {
+        Instance<Index> swapped;
+        swapped.n = inst.n;
+        swapped.hospPref = inst.studPref;
+        swapped.studPref = inst.hospPref;
+        swapped.studRank.assign(inst.n);
+        for (int s = 1; s <= inst.n; s++)
+            for (int k = 1; k <= inst.n; k++) swapped.studRank[s][swapped.studPref[s][k]] = (Index)k;
+
+        MatchingEngine<Index> engine(move(swapped));
+        auto studToHosp = engine.solve().first;
+        pairs.resize(inst.n);
+        for (int s = 1; s <= inst.n; s++) pairs[studToHosp[s] - 1] = {studToHosp[s], s};
+    }
+
+    // entries scanned = sum of the hospitals' ranks of their partners
+    long long scanned = 0;
+    for (int h = 1; h <= inst.n; h++)
+        for (int k = 1; (int)inst.hospPref[h][k] != pairs[h - 1].second; k++) scanned++;
+
+    SimdLevel best = simdLevel();
+    cout << left << setw(28) << name << right << setw(8) << inst.n << setw(14) << scanned
+         << fixed << setprecision(3);
+    double scalarMs = 0;
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+        if (level > best) {
+            cout << setw(12) << "-";
+            continue;
+        }
+        simdLevel() = level;
+        double ms = averageMs(opts, [&] { verifyMatching(inst, pairs, opts.threads); });
+        if (level == SimdLevel::Scalar) scalarMs = ms;
+        cout << setw(12) << ms;
+    }
+    simdLevel() = best;
+    cout << setw(10) << setprecision(2) << scalarMs / averageMs(opts, [&] { verifyMatching(inst, pairs, opts.threads); })
+         << "x (" << simdName(best) << ")\n";
+    cout.unsetf(ios::floatfield);
+}
+
+// bench parse: text parsing throughput (sequential readInstance) with the scalar and AVX2 tokenizers;
+// the instance is written out as text first, so binary and random inputs work too
+template <class Index>
+static void benchParse(const string& name, Instance<Index>& inst, const Options& opts) {
+    ostringstream text;
+    writeTextInstance(text, inst);
+    string data = text.str();
+
+    auto parse = [&] {
+        BufferReader reader(data.data(), data.size());
+        Instance<Index> parsed;
+        string err;
+        int n;
+        if (readInstanceSize(reader, n, err)) readInstance(reader, n, parsed, err);
+    };
+
+    SimdLevel best = simdLevel();
+    cout << left << setw(28) << name << right << setw(8) << inst.n << setw(14) << data.size()
+         << fixed << setprecision(3);
+    simdLevel() = SimdLevel::Scalar;
+    double scalarMs = averageMs(opts, parse);
+    simdLevel() = best;
+    double simdMs = (best >= SimdLevel::Avx2) ? averageMs(opts, parse) : scalarMs;
+    cout << setw(12) << scalarMs;
+    if (best >= SimdLevel::Avx2)
+        cout << setw(12) << simdMs;
+    else
+        cout << setw(12) << "-";
+    cout << setprecision(2) << setw(12) << data.size() / scalarMs / 1e6 << setw(12) << data.size() / simdMs / 1e6
+         << setw(10) << scalarMs / simdMs << "x\n";
+    cout.unsetf(ios::floatfield);
+}
+
+// bench write: match output throughput of the per-pair `<<` loop vs. writeMatching on
+// --threads threads, for a random matching written to a discarding stream
+template <class Index>
+static void benchWrite(const string& name, Instance<Index>& inst, const Options& opts) {
+    int n = inst.n;
+    vector<Index> hospToStud(n + 1, 0);
+    for (auto& [h, s] : randomMatching(n, opts.seed)) hospToStud[h] = (Index)s;
+
+    NullBuffer discard;
+    ostream sink(&discard);
+    string formatted;
+    formatMatching(formatted, hospToStud, 1, n);
+    double bytes = (double)formatted.size();
+
+    double streamMs = averageMs(opts, [&] {
+        for (int h = 1; h <= n; h++) sink << h << " " << hospToStud[h] << "\n";
+    });
+    double writerMs = averageMs(opts, [&] { writeMatching(sink, hospToStud, n, opts.threads); });
+
+    cout << left << setw(28) << name << right << setw(8) << n << setw(14) << (size_t)bytes
+         << fixed << setprecision(3) << setw(12) << streamMs << setw(12) << writerMs << setprecision(2)
+         << setw(12) << bytes / streamMs / 1e6 << setw(12) << bytes / writerMs / 1e6
+         << setw(10) << streamMs / writerMs << "x\n";
+    cout.unsetf(ios::floatfield);
+}
+
+static const vector<string> BENCH_KERNELS = {"rank-table", "rounds", "prefetch", "policy", "verify-all",
+                                             "verify-simd", "parse", "write"};
+
+static void printBenchHeader(const string& kernel) {
+    cout << left << setw(28) << "input" << right << setw(8) << "n"
+         << setw(14) << (kernel == "verify-all" ? "blocking" : kernel == "verify-simd" ? "scanned"
+                         : (kernel == "parse" || kernel == "write") ? "bytes" : "proposals");
+    if (kernel == "rank-table")
+        cout << setw(12) << "solve_ms" << setw(12) << "build_ms" << setw(12) << "table_ms" << setw(11) << "speedup";
+    else if (kernel == "rounds")
+        cout << setw(10) << "rounds" << setw(12) << "solve_ms" << setw(12) << "rounds_ms";
+    else if (kernel == "policy")
+        cout << setw(10) << "policy" << setw(12) << "solve_ms";
+    else if (kernel == "verify-all")
+        cout << setw(12) << "verify_ms" << setw(12) << "Mpairs/s";
+    else if (kernel == "verify-simd")
+        cout << setw(12) << "scalar_ms" << setw(12) << "avx2_ms" << setw(12) << "avx512_ms" << setw(11) << "speedup";
+    else if (kernel == "parse")
+        cout << setw(12) << "scalar_ms" << setw(12) << "avx2_ms" << setw(12) << "scalar_GB/s"
+             << setw(12) << "avx2_GB/s" << setw(11) << "speedup";
+    else if (kernel == "write")
+        cout << setw(12) << "stream_ms" << setw(12) << "writer_ms" << setw(12) << "stream_GB/s"
+             << setw(12) << "writer_GB/s" << setw(11) << "speedup";
+    else if (kernel == "prefetch")
+        cout << setw(12) << "solve_ms" << setw(12) << "lanes_ms" << setw(14) << "solve_Mprop/s"
+             << setw(14) << "lanes_Mprop/s" << setw(11) << "speedup";
+    cout << "\n";
+}
+
+template <class Index>
+static void benchInstance(const string& kernel, const string& name, Instance<Index>& inst, const Options& opts) {
+    if (kernel == "rank-table")
+        benchRankTable(name, inst, opts);
+    else if (kernel == "rounds")
+        benchRounds(name, inst, opts);
+    else if (kernel == "prefetch")
+        benchPrefetch(name, inst, opts);
+    else if (kernel == "policy")
+        benchPolicy(name, inst, opts);
+    else if (kernel == "verify-all")
+        benchVerifyAll(name, inst, opts);
+    else if (kernel == "verify-simd")
+        benchVerifySimd(name, inst, opts);
+    else if (kernel == "parse")
+        benchParse(name, inst, opts);
+    else if (kernel == "write")
+        benchWrite(name, inst, opts);
+}
+
+// bench mode: times one kernel against its baseline on each input
+static int runBench(const vector<string>& args, const Options& opts) {
+    string kernel = (args.size() >= 2) ? args[1] : "";
+    if (find(BENCH_KERNELS.begin(), BENCH_KERNELS.end(), kernel) == BENCH_KERNELS.end() || args.size() < 3) {
+        cerr << "Usage: AlgorithmAssignment1.exe bench [kernel] [input_file | n]..." << endl;
+        cerr << "Kernels:";
+        for (auto& name : BENCH_KERNELS) cerr << " " << name;
+        cerr << endl;
+        return 1;
+    }
+
+    printBenchHeader(kernel);
+    for (size_t i = 2; i < args.size(); i++) {
+        string err;
+        bool ok = withBenchInstance(args[i], opts, err, [&](auto& inst) {
+            benchInstance(kernel, args[i], inst, opts);
+        });
+        if (!ok) cout << args[i] << ": INVALID: " << err << "\n";
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
 
     // arguments
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
-    string mode = (argc >= 2 ? string(argv[1]) : "match");
-    string file1 = (argc >= 3 ? string(argv[2]) : "*");
-    string file2 = (argc >= 4 ? string(argv[3]) : "*");
-    bool timed_mode = (argc >= 5 && string(argv[4]) == "TIMED");
+    vector<string> args;
+    Options opts;
+    string argErr;
+    if (!parseArguments(argc, argv, args, opts, argErr)) {
+        cerr << argErr << endl;
+        return 1;
+    }
+
+    string mode = (args.size() >= 1 ? args[0] : "match");
+    string file1 = (args.size() >= 2 ? args[1] : "*");
+    string file2 = (args.size() >= 3 ? args[2] : "*");
+    bool timed_mode = (args.size() >= 4 && args[3] == "TIMED");
+    opts.timed = timed_mode;
+
+    if (mode == "bench")
+        return runBench(args, opts);
+    if (mode == "serve")
+        return runServe(file1, opts);
+    if (mode == "loadgen")
+        return runLoadgen(file1, file2, opts);
 
     // start timer
     auto begin = chrono::steady_clock::now();
 
     // match mode
     if (mode == "match") {
-        Instance inst;
         string err;
-
-        ifstream stream1;
-        if (file1 != "*")
-            stream1 = ifstream(file1);
-        if (!readInstance((file1 == "*") ? cin : stream1, inst, err)) {
+        if (!withInstance(file1, err, [&](auto& inst) { runMatch(inst, file2, opts); }, nullptr, opts.threads)) {
             cout << "INVALID: " << err << "\n";
             return 0;
         }
-        if (inst.n == 0) return 0;
-
-        MatchingEngine engine(inst.n);
-
-        for (int h = 1; h <= inst.n; h++) {
-            vector<int> prefs;
-            prefs.reserve(inst.n);
-            for (int k = 1; k <= inst.n; k++) prefs.push_back(inst.hospPref[h][k]);
-            engine.set_hospital_preferences(h, prefs);
-        }
-        for (int s = 1; s <= inst.n; s++) {
-            vector<int> prefs;
-            prefs.reserve(inst.n);
-            for (int k = 1; k <= inst.n; k++) prefs.push_back(inst.studPref[s][k]);
-            engine.set_student_preferences(s, prefs);
-        }
-
-        auto [hospToStud, proposals] = engine.solve();
-
-        ofstream stream2;
-        if (file2 != "*")
-            stream2 = ofstream{file2};
-        ostream& outputStream = (file2 == "*") ? cout : stream2;
-        for (int h = 1; h <= inst.n; h++) {
-            outputStream << h << " " << hospToStud[h] << "\n";
-        }
 
         // print time elapsed, if necessary
         if (timed_mode) {
@@ -327,24 +1364,25 @@ int main(int argc, char** argv) {
 
     // verify mode
     if (mode == "verify") {
-        Instance inst;
         string err;
 
-        // read either from input file or terminal
-        ifstream stream1;
-        if (file1 != "*")
-            stream1 = ifstream(file1);
-        if (!readInstance((file1 == "*") ? cin : stream1, inst, err)) {
+        // read either from input file or terminal, then the matching from output file or terminal
+        auto verify = [&](auto& inst) {
+            auto pairs = withReader(file2, [](auto& in) { return readMatchingPairs(in); });
+            if (!opts.allPairs) {
+                cout << verifyMatching(inst, pairs, opts.threads) << "\n";
+                return;
+            }
+            ofstream pairsFile;
+            if (opts.allPairsFile != "*")
+                pairsFile = ofstream(opts.allPairsFile, ios::binary);
+            ostream& pairsOut = (opts.allPairsFile == "*") ? cout : pairsFile;
+            verifyAllBlockingPairs(inst, pairs, opts.threads, pairsOut, cout);
+        };
+        if (!withInstance(file1, err, verify, nullptr, opts.threads)) {
             cout << "INVALID: " << err << "\n";
             return 0;
         }
-
-        // read either from output file or terminal
-        ifstream stream2;
-        if (file2 != "*")
-            stream2 = ifstream(file2);
-        auto pairs = readMatchingPairs((file2 == "*") ? cin : stream2);
-        cout << verifyMatching(inst, pairs) << "\n";
         
         // print time elapsed, if necessary
         if (timed_mode) {
@@ -355,6 +1393,50 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    // convert mode (text -> binary, or binary -> text)
+    if (mode == "convert") {
+        string err;
+        bool wasBinary;
+        auto convert = [&](auto& inst) {
+            ofstream stream2;
+            if (file2 != "*")
+                stream2 = ofstream(file2, ios::binary);
+            ostream& outputStream = (file2 == "*") ? cout : stream2;
+            if (wasBinary)
+                writeTextInstance(outputStream, inst);
+            else
+                writeBinaryInstance(outputStream, inst);
+        };
+        if (!withInstance(file1, err, convert, &wasBinary, opts.threads)) {
+            cout << "INVALID: " << err << "\n";
+            return 0;
+        }
+
+        if (timed_mode) {
+            auto end = std::chrono::steady_clock::now();
+            cout << "Elapsed: " << chrono::duration_cast<chrono::microseconds>(end-begin).count() << " ns" << endl;
+        }
+
+        return 0;
+    }
+
+    // batch mode (many concatenated instances)
+    if (mode == "batch") {
+        withReader(file1, [&](auto& in) {
+            if (opts.pipeline)
+                runBatchPipeline(in, file2, opts);
+            else
+                runBatch(in, file2, opts);
+        });
+
+        if (timed_mode) {
+            auto end = std::chrono::steady_clock::now();
+            cout << "Elapsed: " << chrono::duration_cast<chrono::microseconds>(end-begin).count() << " ns" << endl;
+        }
+
+        return 0;
+    }
+
     // invalid mode
     cerr << "Unknown mode: " << mode << endl << endl;
     cerr 
@@ -363,10 +1445,32 @@ int main(int argc, char** argv) {
         << "    ex. AlgorithmAssignment1.exe match .\\example.in .\\example.out" << endl
         << "  Verify mode:" << endl
         << "    ex. AlgorithmAssignment1.exe verify .\\example.in .\\example.out" << endl
+        << "  Convert mode (text <-> binary instance):" << endl
+        << "    ex. AlgorithmAssignment1.exe convert .\\example.in .\\example.bin" << endl
+        << "  Batch mode (many concatenated instances, one matching per instance):" << endl
+        << "    ex. AlgorithmAssignment1.exe batch .\\many.in .\\many.out" << endl
+        << "  Serve mode (solve requests on a Unix domain socket) and its load generator:" << endl
+        << "    ex. AlgorithmAssignment1.exe serve /tmp/matching.sock --threads=0" << endl
+        << "    ex. AlgorithmAssignment1.exe loadgen /tmp/matching.sock ./example.in --clients=8" << endl
+        << "  Bench mode (kernel timings, inputs are files or a size n for a random instance):" << endl
+        << "    ex. AlgorithmAssignment1.exe bench rank-table .\\scalability\\512.in 4000" << endl
         << "" << endl
         << "  Running without arguments defaults to `match * *`" << endl
         << "  File arguments can be replaced with * to use terminal for input/output" << endl
         << "  TIMED can be added as a final argument to time the code in ns" << endl
+        << "  Options: --rank-table (match: precompute proposer-aligned ranks)," << endl
+        << "           --engine=sequential|parallel|rounds|interleaved," << endl
+        << "           --threads=N (match, verify and batch, 0 = all cores)," << endl
+        << "           --all[=file] (verify: list every blocking pair, with per-hospital counts)," << endl
+        << "           --simd=auto|scalar|avx2|avx512 (vector kernels to use)," << endl
+        << "           --lanes=K (interleaved engine: hospitals in flight, default 8)," << endl
+        << "           --policy=ring|fifo|lifo|random (sequential engine: free-hospital order)," << endl
+        << "           --round-stats (rounds engine: per-round counts)," << endl
+        << "           --pipeline (batch: parse, solve and write on three threads)," << endl
+        << "           --both (match: also the student-optimal matching, and whether they agree)," << endl
+        << "           --max-request=BYTES (serve: largest request accepted, default 1 GiB)," << endl
+        << "           --clients=N, --requests=N, --shm (loadgen)," << endl
+        << "           --runs=N, --seed=N (bench)" << endl
         ;
     return 1;
 }
\ No newline at end of file
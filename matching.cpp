@@ -0,0 +1,397 @@
+// matching library: out-of-line parts of the C++ core (matching.hpp) and the C interface
+// (matching.h)
+#include "matching.hpp"
+#include "matching.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+const char* simdName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx512: return "avx512";
+        case SimdLevel::Avx2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+static SimdLevel detectSimdLevel() {
+#ifdef MATCHING_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel& simdLevel() {
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+bool MappedFile::open(const string& path) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (GetFileType((HANDLE)file) == FILE_TYPE_DISK && GetFileSizeEx((HANDLE)file, &size)) {
+        length = (size_t)size.QuadPart;
+        if (length == 0) return true;   // empty files can't be mapped
+        mapping = CreateFileMappingA((HANDLE)file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) ptr = (const char*)MapViewOfFile((HANDLE)mapping, FILE_MAP_READ, 0, 0, 0);
+        if (ptr) return true;
+        if (mapping) CloseHandle((HANDLE)mapping);
+        mapping = nullptr;
+        length = 0;
+    }
+    // pipes, devices and files that can't be mapped are read instead
+    return readAll([&](char* to, size_t capacity) -> long long {
+        DWORD got = 0;
+        DWORD chunk = (DWORD)std::min<size_t>(capacity, 1u << 30);
+        if (!ReadFile((HANDLE)file, to, chunk, &got, nullptr))
+            return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+        return got;
+    });
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        length = (size_t)st.st_size;
+        if (length == 0) {      // empty files can't be mapped
+            ::close(fd);
+            return true;
+        }
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            ::close(fd);
+            madvise(p, length, MADV_SEQUENTIAL);
+            ptr = (const char*)p;
+            return true;
+        }
+        length = 0;
+    }
+    // FIFOs, process substitution, devices and files that can't be mapped are read
+    // from the same descriptor instead
+    bool ok = readAll([&](char* to, size_t capacity) -> long long {
+        for (;;) {
+            ssize_t got = read(fd, to, capacity);
+            if (got < 0 && errno == EINTR) continue;
+            return got;
+        }
+    });
+    ::close(fd);
+    return ok;
+#endif
+}
+
+void MappedFile::close() {
+    bool mapped = ptr && buffer.empty();
+#ifdef _WIN32
+    if (mapped) UnmapViewOfFile(ptr);
+    if (mapping) CloseHandle((HANDLE)mapping);
+    if (file) CloseHandle((HANDLE)file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (mapped) munmap((void*)ptr, length);
+#endif
+    buffer.clear();
+    buffer.shrink_to_fit();
+    ptr = nullptr;
+    length = 0;
+}
+
+bool isBinaryInstance(const char* data, size_t size) {
+    return size >= sizeof(BINARY_MAGIC) && memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+bool readBinaryHeader(const char* data, size_t size, BinaryHeader& header, string& err) {
+    if (size < sizeof(header)) {
+        err = "BINARY_TRUNCATED_HEADER";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.version != BINARY_VERSION) {
+        err = "BINARY_UNSUPPORTED_VERSION_" + to_string(header.version);
+        return false;
+    }
+    if ((header.width != 2 && header.width != 4) || (header.width == 2 && header.n > UINT16_MAX)) {
+        err = "BINARY_INVALID_WIDTH_" + to_string(header.width);
+        return false;
+    }
+    if (header.n > (uint32_t)INT_MAX) {
+        err = "BINARY_INVALID_N";
+        return false;
+    }
+
+    size_t matrixBytes = (size_t)header.n * header.n * header.width;
+    if (size - sizeof(header) < matrixBytes) {
+        err = "TRUNCATED_HOSPITAL_PREFS";
+        return false;
+    }
+    if (size - sizeof(header) - matrixBytes < matrixBytes) {
+        err = "TRUNCATED_STUDENT_PREFS";
+        return false;
+    }
+    return true;
+}
+
+void Barrier::wait() {
+    unique_lock<mutex> guard(lock);
+    unsigned long long arrived = generation;
+    if (++waiting == threads) {
+        waiting = 0;
+        generation++;
+        released.notify_all();
+        return;
+    }
+    released.wait(guard, [&] { return generation != arrived; });
+}
+
+unsigned resolveThreads(unsigned threads) {
+    if (threads != 0) return threads;
+    return max(1u, thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(unsigned threads) : queues(threads) {
+    for (unsigned id = 0; id < threads; id++)
+        workers.emplace_back([this, id] { work(id); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(idleLock);
+        stopping = true;
+    }
+    idle.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(function<void(unsigned)> task) {
+    WorkQueue& queue = queues[nextQueue.fetch_add(1, memory_order_relaxed) % queues.size()];
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.tasks.push_back(move(task));
+    }
+    {
+        lock_guard<mutex> guard(idleLock);
+        queued++;
+    }
+    idle.notify_one();
+}
+
+bool ThreadPool::take(unsigned id, function<void(unsigned)>& task) {
+    for (unsigned k = 0; k < queues.size(); k++) {
+        WorkQueue& queue = queues[(id + k) % queues.size()];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty()) continue;
+        if (k == 0) {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(unsigned id) {
+    for (;;) {
+        {
+            unique_lock<mutex> guard(idleLock);
+            idle.wait(guard, [&] { return queued > 0 || stopping; });
+            if (queued == 0) return;
+            queued--;
+        }
+        // claiming a task above guarantees one is left in some queue
+        function<void(unsigned)> task;
+        while (!take(id, task)) this_thread::yield();
+        task(id);
+    }
+}
+
+// C interface
+
+struct matching_engine {
+    unsigned threads;
+    tuple<MatchingEngine<uint16_t>, MatchingEngine<uint32_t>> engines{MatchingEngine<uint16_t>(0),
+                                                                       MatchingEngine<uint32_t>(0)};
+};
+
+static bool validView(const matching_prefs* view, uint32_t n) {
+    return view && (view->width == 2 || view->width == 4) && view->stride >= n && (view->data || n == 0) &&
+           (view->width == 4 || n <= UINT16_MAX);
+}
+
+// returns 0 on success, otherwise the first row that is not a permutation of 1..n.
+// Views the caller's rows in place when the entry width matches Index (the caller keeps
+// them alive for the call), copies them otherwise.
+template <class T, class Index>
+static int loadPrefsAs(const matching_prefs& view, int n, bool validate, Matrix<Index>& prefs) {
+    const T* rows = (const T*)view.data;
+    if (validate) {
+        RowChecker check(n);
+        for (int r = 1; r <= n; r++) {
+            const T* row = rows + (size_t)(r - 1) * view.stride;
+            check.beginRow();
+            for (int k = 0; k < n; k++)
+                if (!check.add((long long)row[k])) return r;
+        }
+    }
+
+    if (sizeof(T) == sizeof(Index)) {
+        prefs.borrow((const Index*)rows, n, view.stride, shared_ptr<const void>(rows, [](const void*) {}));
+    } else {
+        prefs.assign(n);
+        for (int r = 1; r <= n; r++) {
+            const T* row = rows + (size_t)(r - 1) * view.stride;
+            copy(row, row + n, prefs[r].begin());
+        }
+    }
+    return 0;
+}
+
+template <class Index>
+static int loadPrefs(const matching_prefs& view, int n, bool validate, Matrix<Index>& prefs) {
+    return (view.width == 2) ? loadPrefsAs<uint16_t>(view, n, validate, prefs)
+                             : loadPrefsAs<uint32_t>(view, n, validate, prefs);
+}
+
+// loads both views into the engine's instance and calls fn(engine, inst); the engine's
+// borrowed views are dropped again before returning
+template <class Fn>
+static int withCallerInstance(matching_engine* engine, uint32_t n, const matching_prefs* hosp,
+                              const matching_prefs* stud, uint32_t flags, int32_t* badRow, Fn fn) {
+    if (badRow) *badRow = 0;
+    if (!engine || !validView(hosp, n) || !validView(stud, n) || n > (uint32_t)INT_MAX)
+        return MATCHING_INVALID_ARGUMENT;
+
+    auto run = [&](auto& solver) {
+        using Index = typename decay_t<decltype(solver.instance())>::IndexType;
+        bool validate = !(flags & MATCHING_ASSUME_VALID);
+        auto inst = solver.release();
+        inst.n = (int)n;
+        inst.myRankAt = Matrix<Index>();
+        int status = MATCHING_OK;
+        if (int r = loadPrefs(*hosp, (int)n, validate, inst.hospPref)) {
+            status = MATCHING_INVALID_HOSPITAL_PREFS;
+            if (badRow) *badRow = r;
+        } else if (int r = loadPrefs(*stud, (int)n, validate, inst.studPref)) {
+            status = MATCHING_INVALID_STUDENT_PREFS;
+            if (badRow) *badRow = r;
+        } else {
+            inst.studRank.assign((int)n);
+            for (int s = 1; s <= (int)n; s++)
+                for (int k = 1; k <= (int)n; k++)
+                    inst.studRank[s][inst.studPref[s][k]] = (Index)k;
+        }
+        solver.adopt(move(inst));
+        if (status == MATCHING_OK) status = fn(solver);
+        dropBorrowedTables(solver);
+        return status;
+    };
+
+    // nothing may escape the C interface; a failed call also leaves no views of the
+    // caller's memory behind in the engine
+    int status;
+    try {
+        // 2-byte tables only when both views have 2-byte entries
+        if (hosp->width == 2 && stud->width == 2) return run(get<0>(engine->engines));
+        return run(get<1>(engine->engines));
+    } catch (const bad_alloc&) {
+        status = MATCHING_OUT_OF_MEMORY;
+    } catch (...) {
+        // e.g. std::system_error when solver threads cannot be started
+        status = MATCHING_INTERNAL_ERROR;
+    }
+    dropBorrowedTables(get<0>(engine->engines));
+    dropBorrowedTables(get<1>(engine->engines));
+    return status;
+}
+
+extern "C" {
+
+int matching_abi_version(void) {
+    return MATCHING_ABI_VERSION;
+}
+
+matching_engine* matching_engine_create(uint32_t threads) {
+    try {
+        return new matching_engine{resolveThreads(threads)};
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void matching_engine_destroy(matching_engine* engine) {
+    delete engine;
+}
+
+int matching_solve(matching_engine* engine, uint32_t n, const matching_prefs* hosp, const matching_prefs* stud,
+                   uint32_t flags, uint32_t* hosp_to_stud, int64_t* proposals, int32_t* bad_row) {
+    if (proposals) *proposals = 0;
+    if (!hosp_to_stud && n > 0) return MATCHING_INVALID_ARGUMENT;
+    return withCallerInstance(engine, n, hosp, stud, flags, bad_row, [&](auto& solver) {
+        if (n == 0) return (int)MATCHING_OK;
+        auto result = (engine->threads > 1) ? solver.solveParallel(engine->threads) : solver.solve();
+        for (uint32_t h = 1; h <= n; h++) hosp_to_stud[h - 1] = result.first[h];
+        if (proposals) *proposals = result.second;
+        return (int)MATCHING_OK;
+    });
+}
+
+int matching_verify(matching_engine* engine, uint32_t n, const matching_prefs* hosp, const matching_prefs* stud,
+                    uint32_t flags, const uint32_t* hosp_to_stud, int32_t* blocking) {
+    if (blocking) blocking[0] = blocking[1] = 0;
+    if (!hosp_to_stud && n > 0) return MATCHING_INVALID_ARGUMENT;
+    return withCallerInstance(engine, n, hosp, stud, flags, nullptr, [&](auto& solver) {
+        using Index = typename decay_t<decltype(solver.instance())>::IndexType;
+        vector<pair<int,int>> pairs(n);
+        for (uint32_t h = 1; h <= n; h++)
+            pairs[h - 1] = {(int)h, (int)min(hosp_to_stud[h - 1], (uint32_t)INT_MAX)};
+        vector<Index> hospToStud, studToHosp;
+        if (!checkMatching((int)n, pairs, hospToStud, studToHosp).empty()) return (int)MATCHING_INVALID_MATCHING;
+
+        auto [h, s] = findBlockingPair(solver.instance(), hospToStud, studToHosp, engine->threads);
+        if (!h) return (int)MATCHING_OK;
+        if (blocking) {
+            blocking[0] = h;
+            blocking[1] = s;
+        }
+        return (int)MATCHING_UNSTABLE;
+    });
+}
+
+const char* matching_status_name(int status) {
+    switch (status) {
+        case MATCHING_OK: return "OK";
+        case MATCHING_UNSTABLE: return "UNSTABLE";
+        case MATCHING_INVALID_MATCHING: return "INVALID_MATCHING";
+        case MATCHING_INVALID_ARGUMENT: return "INVALID_ARGUMENT";
+        case MATCHING_INVALID_HOSPITAL_PREFS: return "INVALID_HOSPITAL_PREFS";
+        case MATCHING_INVALID_STUDENT_PREFS: return "INVALID_STUDENT_PREFS";
+        case MATCHING_OUT_OF_MEMORY: return "OUT_OF_MEMORY";
+        case MATCHING_INTERNAL_ERROR: return "INTERNAL_ERROR";
+        default: return "UNKNOWN";
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ *  C interface of the matching library (matching_static / matching).
+ *
+ *  Preference tables are passed as row-major n x n views over caller memory with 2- or
+ *  4-byte entries. The engine uses 2-byte tables when both views have 2-byte entries and
+ *  4-byte tables otherwise; a view whose width matches is read in place, the other (2-byte
+ *  hospital with 4-byte student entries, or the reverse) is copied. Views are not kept
+ *  after a call returns.
+ *  Ids are 1-based, as in the text format. An engine keeps its scratch tables between
+ *  calls, so reusing one engine for a stream of instances avoids reallocating them.
+ *  Engines are not thread-safe: use one per calling thread.
+ */
+#ifndef MATCHING_H
+#define MATCHING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(MATCHING_SHARED)
+#ifdef MATCHING_BUILD
+#define MATCHING_API __declspec(dllexport)
+#else
+#define MATCHING_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__) || defined(__clang__)
+#define MATCHING_API __attribute__((visibility("default")))
+#else
+#define MATCHING_API
+#endif
+
+#define MATCHING_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* row r (1-based) of the table starts at (const char*)data + (r - 1) * stride * width */
+typedef struct matching_prefs {
+    const void* data;
+    size_t stride;      /* entries per row, >= n */
+    uint32_t width;     /* bytes per entry: 2 or 4 */
+} matching_prefs;
+
+enum {
+    MATCHING_OK = 0,
+    MATCHING_UNSTABLE = 1,                  /* matching_verify: a blocking pair exists */
+    MATCHING_INVALID_MATCHING = 2,          /* matching_verify: not a perfect matching */
+    MATCHING_INVALID_ARGUMENT = 3,
+    MATCHING_INVALID_HOSPITAL_PREFS = 4,    /* a row is not a permutation of 1..n */
+    MATCHING_INVALID_STUDENT_PREFS = 5,
+    MATCHING_OUT_OF_MEMORY = 6,
+    MATCHING_INTERNAL_ERROR = 7             /* any other failure, e.g. threads could not be started */
+};
+
+/* skip checking that every row is a permutation of 1..n (the caller guarantees it) */
+#define MATCHING_ASSUME_VALID 1u
+
+typedef struct matching_engine matching_engine;
+
+/* MATCHING_ABI_VERSION of the loaded library */
+MATCHING_API int matching_abi_version(void);
+
+/* threads: solver and verifier threads, 0 = all cores; returns NULL on failure */
+MATCHING_API matching_engine* matching_engine_create(uint32_t threads);
+MATCHING_API void matching_engine_destroy(matching_engine* engine);
+
+/*
+ *  Hospital-optimal stable matching. hosp_to_stud[h - 1] receives hospital h's student.
+ *  proposals and bad_row may be NULL; bad_row receives the first invalid row (1-based)
+ *  with MATCHING_INVALID_*_PREFS, 0 otherwise.
+ */
+MATCHING_API int matching_solve(matching_engine* engine, uint32_t n, const matching_prefs* hosp,
+                                const matching_prefs* stud, uint32_t flags, uint32_t* hosp_to_stud,
+                                int64_t* proposals, int32_t* bad_row);
+
+/*
+ *  Checks that hosp_to_stud (hospital h -> hosp_to_stud[h - 1]) is a stable perfect
+ *  matching. With MATCHING_UNSTABLE, blocking (may be NULL) receives the lowest hospital in
+ *  a blocking pair and its first blocking student; with MATCHING_INVALID_MATCHING, {0, 0}.
+ */
+MATCHING_API int matching_verify(matching_engine* engine, uint32_t n, const matching_prefs* hosp,
+                                 const matching_prefs* stud, uint32_t flags, const uint32_t* hosp_to_stud,
+                                 int32_t* blocking);
+
+/* "OK", "UNSTABLE", ... for a status code */
+MATCHING_API const char* matching_status_name(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1957 @@
+// C++ core of the matching engine, shared by the matching library and the command line tool:
+// preference tables, text and binary instance readers, the MatchingEngine solvers, the
+// verifier and the threading helpers. Out-of-line parts live in matching.cpp; the stable
+// C interface for embedding is matching.h.
+#ifndef MATCHING_HPP
+#define MATCHING_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <deque>
+#include <chrono>
+#include <fstream>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <charconv>
+#include <functional>
+#include <tuple>
+#include <sstream>
+#include <future>
+
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
+// AVX2/AVX-512 tokenizer and verifier kernels, picked at runtime (GCC/Clang on x86 only)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MATCHING_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+struct Matching
+{
+    int hospital;
+    int student;
+};
+
+// one row of a Matrix, indexed 1..n
+template <class T>
+class RowView
+{
+    T* ptr;
+    int len;
+
+public:
+    RowView(T* ptr, int len) : ptr(ptr), len(len) {}
+
+    T& operator[](int k) const { return ptr[k - 1]; }
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + len; }
+    int size() const { return len; }
+};
+
+// n x n table in a single buffer with a fixed stride, indexed 1..n in both dimensions.
+// Either owns its buffer or views external memory (e.g. a mapped binary file),
+// in which case `owner` keeps that memory alive and the view is read-only.
+template <class T>
+class Matrix
+{
+    std::vector<T> storage;
+    T* base = nullptr;
+    int n = 0;
+    size_t rowStride = 0;
+    std::shared_ptr<const void> owner;
+
+public:
+    Matrix() = default;
+
+    // copies own their data; moves keep the buffer (and any borrowed view) without copying
+    Matrix(const Matrix& other) { *this = other; }
+    Matrix(Matrix&& other) noexcept { *this = std::move(other); }
+
+    Matrix& operator=(const Matrix& other) {
+        if (this == &other) return *this;
+        assign(other.n);
+        for (int i = 1; i <= n; i++)
+            std::copy(other[i].begin(), other[i].end(), (*this)[i].begin());
+        return *this;
+    }
+
+    Matrix& operator=(Matrix&& other) noexcept {
+        storage = std::move(other.storage);
+        owner = std::move(other.owner);
+        base = other.base;
+        n = other.n;
+        rowStride = other.rowStride;
+        other.storage.clear();
+        other.base = nullptr;
+        other.n = 0;
+        other.rowStride = 0;
+        return *this;
+    }
+
+    // spare entries after an owned table, so a 4-byte SIMD gather of the last
+    // 2-byte entry stays inside the buffer
+    static const size_t PADDING = 16;
+
+    // allocate an owned, zeroed n x n table
+    void assign(int size) {
+        owner.reset();
+        n = size;
+        rowStride = (size_t)size;
+        storage.assign(rowStride * size + PADDING, T(0));
+        base = storage.data();
+    }
+
+    // view n rows of `stride` entries at data without copying
+    void borrow(const T* data, int size, size_t stride, std::shared_ptr<const void> keepAlive) {
+        storage.clear();
+        storage.shrink_to_fit();
+        owner = std::move(keepAlive);
+        n = size;
+        rowStride = stride;
+        base = const_cast<T*>(data);
+    }
+
+    RowView<T> operator[](int i) { return {base + (size_t)(i - 1) * rowStride, n}; }
+    RowView<const T> operator[](int i) const { return {base + (size_t)(i - 1) * rowStride, n}; }
+
+    int size() const { return n; }
+    size_t stride() const { return rowStride; }
+    const T* data() const { return base; }
+    bool borrowed() const { return owner != nullptr; }
+};
+
+// make tables for preferences
+// Index is the entry type of the n x n tables: uint16_t whenever every id and rank
+// fits (n < 65536), uint32_t otherwise. See withIndexType.
+template <class Index>
+struct Instance {
+    using IndexType = Index;
+
+    int n = 0;
+
+    Matrix<Index> hospPref;
+    Matrix<Index> studPref;
+    Matrix<Index> studRank;   // studRank[s][h] = position of h in s's list
+
+    // optional, see buildRankTable: myRankAt[h][k] = studRank[hospPref[h][k]][h]
+    Matrix<Index> myRankAt;
+
+    // filled by solveStudentOptimal: hospRank[h][s] = position of s in h's list
+    Matrix<Index> hospRank;
+};
+
+// calls fn(Index{}) with the narrowest table entry type that holds 1..n
+template <class Fn>
+void withIndexType(long long n, Fn fn) {
+    if (n <= UINT16_MAX)
+        fn(uint16_t{});
+    else
+        fn(uint32_t{});
+}
+
+// parsing and validation helpers
+template <class T>
+bool isPermutation1toN(const T* line, size_t size, int n) {
+    if (size != (size_t)n) return false;
+    std::vector<char> seen(n + 1, 0);
+    for (size_t k = 0; k < size; k++) {
+        long long v = (long long)line[k];
+        if (v < 1 || v > n) return false;
+        if (seen[v]) return false;
+        seen[v] = 1;
+    }
+    return true;
+}
+
+inline bool isPermutation1toN(const std::vector<int>& line, int n) {
+    return isPermutation1toN(line.data(), line.size(), n);
+}
+
+// checks rows of n values one entry at a time; seen[v] holds the number of the
+// last row that contained v, so nothing is cleared between rows
+class RowChecker
+{
+public:
+    explicit RowChecker(int n) : n(n), seen(n + 1, 0) {}
+
+    void beginRow() { row++; }
+
+    // false when v is out of range or already appeared in this row
+    bool add(long long v) {
+        if (v < 1 || v > n || seen[v] == row) return false;
+        seen[v] = row;
+        return true;
+    }
+
+private:
+    int n;
+    std::vector<uint32_t> seen;
+    uint32_t row = 0;
+};
+
+// read-only view of a whole input file mapped into memory. Pipes, FIFOs, devices and
+// files that can't be mapped are read into an owned buffer instead (4-byte aligned, like
+// a mapping, so binary images can be viewed in place either way).
+class MappedFile
+{
+    const char* ptr = nullptr;
+    size_t length = 0;
+    std::vector<uint32_t> buffer;   // contents when not mapped
+#ifdef _WIN32
+    void* file = nullptr;       // HANDLEs (windows.h stays out of this header)
+    void* mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // returns false if the file can't be opened or read (it then reads as empty)
+    bool open(const std::string& path);
+    void close();
+
+private:
+    // reads everything left in a file through read(buffer, capacity) -> bytes (0 at the end)
+    template <class Read>
+    bool readAll(Read read) {
+        size_t used = 0;
+        for (;;) {
+            if (used == buffer.size() * sizeof(uint32_t))
+                buffer.resize(std::max<size_t>(1 << 14, buffer.size() * 2));
+            long long got = read((char*)buffer.data() + used, buffer.size() * sizeof(uint32_t) - used);
+            if (got < 0) return false;
+            if (got == 0) break;
+            used += (size_t)got;
+        }
+        ptr = (const char*)buffer.data();
+        length = used;
+        return true;
+    }
+
+public:
+
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+};
+
+// appends v in decimal (std::to_chars, no locale or stream state involved)
+inline void appendInt(std::string& out, long long v) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), v);
+    out.append(digits, result.ptr);
+}
+
+// collects output in a large buffer and hands it to the stream in big write() calls
+class BufferedWriter
+{
+    std::ostream& out;
+    std::string buffer;
+    size_t limit;
+
+public:
+    explicit BufferedWriter(std::ostream& out, size_t limit = 1 << 20) : out(out), limit(limit) {
+        buffer.reserve(limit + 64);
+    }
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+    ~BufferedWriter() { flush(); }
+
+    void write(const char* data, size_t size) {
+        if (buffer.size() + size > limit) {
+            flush();
+            if (size > limit) {
+                out.write(data, (std::streamsize)size);
+                return;
+            }
+        }
+        buffer.append(data, size);
+    }
+    void write(const std::string& text) { write(text.data(), text.size()); }
+
+    void writeInt(long long v) {
+        if (buffer.size() + 24 > limit) flush();
+        appendInt(buffer, v);
+    }
+    void put(char c) {
+        if (buffer.size() + 1 > limit) flush();
+        buffer.push_back(c);
+    }
+
+    void flush() {
+        if (!buffer.empty()) out.write(buffer.data(), (std::streamsize)buffer.size());
+        buffer.clear();
+    }
+};
+
+// instruction sets the SIMD kernels (tokenizer, verifier) can use, best last
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+const char* simdName(SimdLevel level);
+
+// level in use: the best the CPU supports unless lowered with --simd
+SimdLevel& simdLevel();
+
+// token readers: readInstance/readMatchingPairs pull integers through next(v), or a run
+// of them through next(values, count), which fail the same way `in >> v` does (missing,
+// non-numeric or out of range); the run stops at the first failure
+
+// reads from an istream (used for stdin)
+struct StreamReader {
+    std::istream& in;
+
+    bool next(int& v) { return (bool)(in >> v); }
+
+    size_t next(int* values, size_t count) {
+        size_t read = 0;
+        while (read < count && next(values[read])) read++;
+        return read;
+    }
+
+    // skips whitespace; true when nothing else was left (or the stream failed)
+    bool atEnd() {
+        in >> std::ws;
+        return !in.good();
+    }
+};
+
+// decodes integers straight from an in-memory buffer (e.g. a MappedFile)
+struct BufferReader {
+    const char* p;
+    const char* end;
+
+    BufferReader(const char* begin, size_t size) : p(begin), end(begin + size) {}
+
+    bool next(int& v) {
+        while (p < end && isSpace(*p)) p++;
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+        if (p == end || !isDigit(*p)) return fail();
+
+        // accumulate as negative so INT_MIN is representable
+        long long value = 0;
+        while (p < end && isDigit(*p)) {
+            value = value * 10 - (*p - '0');
+            if (value < (long long)INT_MIN) return fail();
+            p++;
+        }
+        if (!negative) {
+            value = -value;
+            if (value > INT_MAX) return fail();
+        }
+        v = (int)value;
+        return true;
+    }
+
+    size_t next(int* values, size_t count) {
+        size_t read = 0;
+#ifdef MATCHING_X86_SIMD
+        if (simdLevel() >= SimdLevel::Avx2) read = nextAvx2(values, count);
+#endif
+        while (read < count && next(values[read])) read++;
+        return read;
+    }
+
+    // skips whitespace; true when nothing else was left
+    bool atEnd() {
+        while (p < end && isSpace(*p)) p++;
+        return p == end;
+    }
+
+    // skips up to count whitespace-separated words without decoding them and returns how
+    // many were skipped (batch mode uses this to find where an instance ends).
+    // digitsOnly is cleared if a skipped word holds anything but digits: next() splits such
+    // words differently (e.g. "1+2" is two tokens), so only all-digit words are sure to be
+    // the tokens the parser reads.
+    size_t skip(size_t count, bool* digitsOnly = nullptr) {
+        size_t skipped = 0;
+        bool plain = true;
+#ifdef MATCHING_X86_SIMD
+        if (simdLevel() >= SimdLevel::Avx2) skipped = skipAvx2(count, plain);
+#endif
+        while (skipped < count) {
+            while (p < end && isSpace(*p)) p++;
+            if (p == end) break;
+            for (; p < end && !isSpace(*p); p++)
+                plain &= isDigit(*p);
+            skipped++;
+        }
+        if (digitsOnly) *digitsOnly = plain;
+        return skipped;
+    }
+
+private:
+    static bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    // like a stream's failbit, every read after a failure fails too
+    bool fail() {
+        p = end;
+        return false;
+    }
+
+#ifdef MATCHING_X86_SIMD
+    // value of 1..8 decimal digits at s (loads 8 bytes; little-endian SWAR)
+    static uint32_t parseDigits(const char* s, int len) {
+        uint64_t v;
+        memcpy(&v, s, sizeof(v));
+        // drop what follows the digits and pad them with leading '0's to 8
+        if (len < 8) v = (v << (8 * (8 - len))) | (0x3030303030303030ull >> (8 * len));
+        v -= 0x3030303030303030ull;
+        v = v * 10 + (v >> 8);
+        v = ((v & 0x000000FF000000FFull) * 0x000F424000000064ull
+             + ((v >> 16) & 0x000000FF000000FFull) * 0x0000271000000001ull) >> 32;
+        return (uint32_t)v;
+    }
+
+    // counts word starts 32 bytes at a time for skip(), up to the block holding the last
+    // word to skip; leaves p at a word boundary so the scalar loop can finish.
+    // plain is cleared if a skipped byte is neither whitespace nor a digit.
+    __attribute__((target("avx2,popcnt")))
+    size_t skipAvx2(size_t count, bool& plain) {
+        const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8('9');
+        const __m256i tab = _mm256_set1_epi8('\t'), cr = _mm256_set1_epi8('\r');
+        const __m256i blank = _mm256_set1_epi8(' ');
+        size_t skipped = 0;
+        uint32_t carry = 0;     // 1 if the byte before the block ends a word
+        uint32_t other = 0;     // bytes of skipped blocks that are neither digits nor whitespace
+        while (end - p >= 32) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)p);
+            __m256i digit = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, zero), bytes),
+                                             _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, nine), bytes));
+            __m256i space = _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, tab), bytes),
+                                 _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, cr), bytes)),
+                _mm256_cmpeq_epi8(bytes, blank));
+            uint32_t words = ~(uint32_t)_mm256_movemask_epi8(space);
+            uint32_t starts = words & ~((words << 1) | carry);
+            size_t found = (size_t)__builtin_popcount(starts);
+            if (skipped + found >= count) break;
+            skipped += found;
+            other |= words & ~(uint32_t)_mm256_movemask_epi8(digit);
+            carry = words >> 31;
+            p += 32;
+        }
+        // the word running into the block was counted already
+        if (carry)
+            for (; p < end && !isSpace(*p); p++)
+                plain &= isDigit(*p);
+        if (other) plain = false;
+        return skipped;
+    }
+
+    // Tokenizes 32 bytes at a time: each block is classified into digits and whitespace,
+    // token starts and ends come from the digit mask, and tokens of up to 8 digits that end
+    // inside the block are converted with parseDigits. A block holding any other byte (a
+    // sign, junk) or a longer token hands one token to next(v), which keeps its failure
+    // rules. p never stops inside a token, so a digit at bit 0 always starts one.
+    __attribute__((target("avx2")))
+    size_t nextAvx2(int* values, size_t count) {
+        const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8('9');
+        const __m256i tab = _mm256_set1_epi8('\t'), cr = _mm256_set1_epi8('\r');
+        const __m256i blank = _mm256_set1_epi8(' ');
+
+        size_t read = 0;
+        // a block, plus the 8 bytes parseDigits may load from its last token
+        while (read < count && end - p >= 40) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)p);
+            __m256i digit = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, zero), bytes),
+                                             _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, nine), bytes));
+            __m256i space = _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, tab), bytes),
+                                 _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, cr), bytes)),
+                _mm256_cmpeq_epi8(bytes, blank));
+            uint32_t digits = (uint32_t)_mm256_movemask_epi8(digit);
+            uint32_t spaces = (uint32_t)_mm256_movemask_epi8(space);
+
+            bool slow = (digits | spaces) != 0xFFFFFFFFu;
+            uint32_t starts = digits & ~(digits << 1);
+            uint32_t ends = ~digits & (digits << 1);
+            const char* block = p;
+            p += 32;
+            while (!slow && starts) {
+                int s = __builtin_ctz(starts);
+                if (!ends) {
+                    // the last token runs past the block; a token filling it takes the slow path
+                    p = block + s;
+                    slow = (s == 0);
+                    break;
+                }
+                int e = __builtin_ctz(ends);
+                starts &= starts - 1;
+                ends &= ends - 1;
+                if (e - s > 8) {
+                    p = block + s;
+                    slow = true;
+                    break;
+                }
+                values[read++] = (int)parseDigits(block + s, e - s);
+                if (read == count) {
+                    p = block + e;
+                    break;
+                }
+            }
+            if (slow) {
+                if (p == block + 32) p = block;
+                if (!next(values[read])) return read;
+                read++;
+            }
+        }
+        return read;
+    }
+#endif
+};
+
+// reads the leading n of a text instance
+template <class Reader>
+bool readInstanceSize(Reader& in, int& n, std::string& err) {
+    if (!in.next(n)) {
+        err = "EMPTY_OR_MISSING_N";
+        return false;
+    }
+    if (n < 0) {
+        err = "INVALID_N_NEGATIVE";
+        return false;
+    }
+    return true;
+}
+
+// reads one preference row of n values into row, a chunk of tokens at a time, filling
+// rank (when given, 0-indexed by hospital) as it goes; returns false if the row was cut
+// short, and sets valid to whether it is a permutation of 1..n
+template <class Reader, class Index>
+bool readRow(Reader& in, int n, RowChecker& check, RowView<Index> row, Index* rank, bool& valid) {
+    const int CHUNK = 1024;
+    int values[CHUNK];
+    valid = true;
+    check.beginRow();
+    for (int k = 1; k <= n;) {
+        int count = std::min(n - k + 1, CHUNK);
+        if (in.next(values, (size_t)count) < (size_t)count) return false;
+        for (int j = 0; j < count; j++, k++) {
+            int v = values[j];
+            if (check.add(v)) {
+                if (rank) rank[v - 1] = (Index)k;
+            } else {
+                valid = false;
+            }
+            row[k] = (Index)v;
+        }
+    }
+    return true;
+}
+
+// reads the 2n preference lines that follow n
+template <class Reader, class Index>
+bool readInstance(Reader& in, int n, Instance<Index>& inst, std::string& err) {
+    inst.n = n;
+    inst.hospPref.assign(n);
+    inst.studPref.assign(n);
+    inst.studRank.assign(n);
+
+    // each row is parsed straight into its table, checked as it is read and,
+    // for students, ranked in the same pass; a bad row is still read to its end
+    // so that truncation takes precedence as before
+    RowChecker check(n);
+    bool valid;
+
+    // Hospitals
+    for (int h = 1; h <= n; h++) {
+        if (!readRow(in, n, check, inst.hospPref[h], (Index*)nullptr, valid)) {
+            err = "TRUNCATED_HOSPITAL_PREFS";
+            return false;
+        }
+        if (!valid) {
+            err = "INVALID_HOSPITAL_PREF_LINE_" + std::to_string(h);
+            return false;
+        }
+    }
+
+    // Students
+    for (int s = 1; s <= n; s++) {
+        if (!readRow(in, n, check, inst.studPref[s], &inst.studRank[s][1], valid)) {
+            err = "TRUNCATED_STUDENT_PREFS";
+            return false;
+        }
+        if (!valid) {
+            err = "INVALID_STUDENT_PREF_LINE_" + std::to_string(s);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// binary instance format (version 1), written by `convert`:
+//   16 byte BinaryHeader, then the hospital and student preference matrices,
+//   each n x n row-major with `width` bytes (2 or 4) per entry in native byte order.
+// The header is 16 bytes so the matrices stay aligned inside a mapped file.
+inline const char BINARY_MAGIC[4] = {'S', 'M', 'I', 'B'};
+inline const uint32_t BINARY_VERSION = 1;
+
+struct BinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n;
+    uint32_t width;
+};
+static_assert(sizeof(BinaryHeader) == 16, "binary header must stay 16 bytes");
+
+bool isBinaryInstance(const char* data, size_t size);
+
+// fills one preference matrix from the binary image, validating each row;
+// entries as wide as Index are viewed in place when `mapping` is set
+// returns 0 on success, otherwise the first invalid row
+template <class T, class Index>
+int loadBinaryPrefs(const char* data, int n, Matrix<Index>& prefs, const std::shared_ptr<const void>& mapping) {
+    const T* rows = (const T*)data;
+    RowChecker check(n);
+    for (int r = 1; r <= n; r++) {
+        const T* row = rows + (size_t)(r - 1) * n;
+        check.beginRow();
+        for (int k = 0; k < n; k++)
+            if (!check.add((long long)row[k])) return r;
+    }
+
+    if (sizeof(T) == sizeof(Index) && mapping) {
+        prefs.borrow((const Index*)data, n, n, mapping);
+    } else {
+        prefs.assign(n);
+        for (int r = 1; r <= n; r++)
+            std::copy(rows + (size_t)(r - 1) * n, rows + (size_t)r * n, prefs[r].begin());
+    }
+    return 0;
+}
+
+// checks the header of a binary image and that both matrices are present
+bool readBinaryHeader(const char* data, size_t size, BinaryHeader& header, std::string& err);
+
+// loads a binary image (data must be 4-byte aligned) whose header readBinaryHeader accepted;
+// reports the same errors as readInstance.
+// If mapping is set (it keeps data alive) matrices are viewed in place where possible.
+template <class Index>
+bool loadBinaryInstance(const char* data, const BinaryHeader& header, Instance<Index>& inst, std::string& err,
+                        const std::shared_ptr<const void>& mapping = nullptr) {
+    int n = (int)header.n;
+    const char* hosp = data + sizeof(header);
+    const char* stud = hosp + (size_t)n * n * header.width;
+
+    inst.n = n;
+    int badRow = (header.width == 2) ? loadBinaryPrefs<uint16_t>(hosp, n, inst.hospPref, mapping)
+                                     : loadBinaryPrefs<uint32_t>(hosp, n, inst.hospPref, mapping);
+    if (badRow) {
+        err = "INVALID_HOSPITAL_PREF_LINE_" + std::to_string(badRow);
+        return false;
+    }
+    badRow = (header.width == 2) ? loadBinaryPrefs<uint16_t>(stud, n, inst.studPref, mapping)
+                                 : loadBinaryPrefs<uint32_t>(stud, n, inst.studPref, mapping);
+    if (badRow) {
+        err = "INVALID_STUDENT_PREF_LINE_" + std::to_string(badRow);
+        return false;
+    }
+
+    inst.studRank.assign(n);
+    for (int s = 1; s <= n; s++)
+        for (int k = 1; k <= n; k++)
+            inst.studRank[s][inst.studPref[s][k]] = (Index)k;
+    return true;
+}
+
+template <class T, class Index>
+void writeBinaryPrefs(std::ostream& out, const Matrix<Index>& prefs, int n) {
+    std::vector<T> row(n);
+    for (int r = 1; r <= n; r++) {
+        std::copy(prefs[r].begin(), prefs[r].end(), row.begin());
+        out.write((const char*)row.data(), (std::streamsize)(row.size() * sizeof(T)));
+    }
+}
+
+// 2-byte entries whenever every id fits, 4-byte otherwise
+template <class Index>
+void writeBinaryInstance(std::ostream& out, const Instance<Index>& inst) {
+    BinaryHeader header;
+    memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version = BINARY_VERSION;
+    header.n = (uint32_t)inst.n;
+    header.width = (inst.n <= UINT16_MAX) ? 2 : 4;
+    out.write((const char*)&header, sizeof(header));
+
+    if (header.width == 2) {
+        writeBinaryPrefs<uint16_t>(out, inst.hospPref, inst.n);
+        writeBinaryPrefs<uint16_t>(out, inst.studPref, inst.n);
+    } else {
+        writeBinaryPrefs<uint32_t>(out, inst.hospPref, inst.n);
+        writeBinaryPrefs<uint32_t>(out, inst.studPref, inst.n);
+    }
+}
+
+template <class Index>
+void writeTextPrefs(std::ostream& out, const Matrix<Index>& prefs, int n) {
+    for (int r = 1; r <= n; r++) {
+        for (int k = 1; k <= n; k++) {
+            if (k > 1) out << ' ';
+            out << prefs[r][k];
+        }
+        out << '\n';
+    }
+}
+
+// same layout as example.in
+template <class Index>
+void writeTextInstance(std::ostream& out, const Instance<Index>& inst) {
+    out << inst.n << '\n';
+    writeTextPrefs(out, inst.hospPref, inst.n);
+    writeTextPrefs(out, inst.studPref, inst.n);
+}
+
+// Precomputes myRankAt so solve() reads a hospital's rank at each student it proposes
+// to sequentially instead of through a random studRank row.
+// studRank is read a cache line's worth of hospital columns at a time: the block is
+// transposed into a small scratch table first, then each hospital's row is gathered from it.
+template <class Index>
+void buildRankTable(Instance<Index>& inst) {
+    int n = inst.n;
+    const int block = std::max(1, (int)(64 / sizeof(Index)));
+    std::vector<Index> columns((size_t)block * n);     // columns[j * n + (s - 1)] = studRank[s][h0 + j]
+
+    inst.myRankAt.assign(n);
+    for (int h0 = 1; h0 <= n; h0 += block) {
+        int width = std::min(block, n - h0 + 1);
+        for (int s = 1; s <= n; s++) {
+            const Index* ranks = &inst.studRank[s][h0];
+            for (int j = 0; j < width; j++)
+                columns[(size_t)j * n + (s - 1)] = ranks[j];
+        }
+        for (int j = 0; j < width; j++) {
+            int h = h0 + j;
+            const Index* column = &columns[(size_t)j * n] - 1;
+            auto prefs = inst.hospPref[h];
+            auto out = inst.myRankAt[h];
+            for (int k = 1; k <= n; k++)
+                out[k] = column[prefs[k]];
+        }
+    }
+}
+
+// hint that *p will be read soon
+inline void prefetch(const void* p) {
+#ifdef _MSC_VER
+    _mm_prefetch((const char*)p, _MM_HINT_T0);
+#else
+    __builtin_prefetch(p);
+#endif
+}
+
+// runs fn(id) on `threads` threads (ids 0..threads-1) and waits for all of them;
+// thread 0 is the calling thread
+template <class Fn>
+void runThreads(unsigned threads, Fn fn) {
+    std::vector<std::thread> workers;
+    for (unsigned id = 1; id < threads; id++)
+        workers.emplace_back(fn, id);
+    fn(0u);
+    for (auto& worker : workers) worker.join();
+}
+
+// reusable barrier for a fixed set of threads (C++17 has no std::barrier)
+class Barrier
+{
+    std::mutex lock;
+    std::condition_variable released;
+    unsigned threads;
+    unsigned waiting = 0;
+    unsigned long long generation = 0;
+
+public:
+    explicit Barrier(unsigned threads) : threads(threads) {}
+
+    void wait();
+};
+
+// [begin, end) of thread `id`'s share of `total` items
+inline std::pair<size_t, size_t> threadRange(size_t total, unsigned id, unsigned threads) {
+    return {total * id / threads, total * (id + 1) / threads};
+}
+
+// 0 means "one per hardware thread"
+unsigned resolveThreads(unsigned threads);
+
+// fixed set of worker threads running submitted tasks. Tasks are dealt round-robin onto
+// per-worker queues; a worker serves its own queue oldest first and steals the newest
+// task of another worker when its own is empty. Each task gets the id of the worker
+// running it (0..threads-1), e.g. to use per-worker state. The destructor runs every
+// task already submitted before joining the workers.
+class ThreadPool
+{
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<std::function<void(unsigned)>> tasks;
+    };
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+    std::mutex idleLock;
+    std::condition_variable idle;
+    size_t queued = 0;      // tasks not yet claimed by a worker (guarded by idleLock)
+    bool stopping = false;
+    std::atomic<unsigned> nextQueue{0};
+
+public:
+    explicit ThreadPool(unsigned threads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    unsigned size() const { return (unsigned)queues.size(); }
+
+    // thread-safe: any number of threads may submit at once
+    void submit(std::function<void(unsigned)> task);
+
+private:
+    bool take(unsigned id, std::function<void(unsigned)>& task);
+    void work(unsigned id);
+};
+
+// bounded single-producer/single-consumer ring buffer; push and pop never block and
+// return false when the ring is full or empty
+template <class T>
+class SpscQueue
+{
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0};     // next slot to pop (consumer)
+    alignas(64) std::atomic<size_t> tail{0};     // next slot to push (producer)
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    bool push(T value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % slots.size();
+        if (next == head.load(std::memory_order_acquire)) return false;
+        slots[t] = std::move(value);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = std::move(slots[h]);
+        head.store((h + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+};
+
+// Scheduling policies for the free hospitals in MatchingEngine::solve().
+// The matching is the same under every policy, and so is the proposal count (each hospital
+// proposes down its list exactly as far as its final partner); the order of proposals,
+// and with it the memory access pattern, is what changes.
+// Interface: reset(n) with hospitals 1..n free, empty(), front() (the hospital to serve,
+// stable until pop()), pop(), push(h).
+
+// FIFO on a std::deque (the original solve() queue)
+struct FifoQueue {
+    static const char* name() { return "fifo"; }
+
+    std::deque<int> items;
+
+    void reset(int n) {
+        items.clear();
+        for (int h = 1; h <= n; h++) items.push_back(h);
+    }
+    bool empty() const { return items.empty(); }
+    int front() const { return items.front(); }
+    void pop() { items.pop_front(); }
+    void push(int h) { items.push_back(h); }
+};
+
+// FIFO in a fixed ring of n slots (never more than n hospitals are free), no chunk allocations
+struct RingQueue {
+    static const char* name() { return "ring"; }
+
+    std::vector<int> slots;
+    size_t head = 0, used = 0;
+
+    void reset(int n) {
+        slots.resize(std::max(1, n));
+        for (int h = 1; h <= n; h++) slots[h - 1] = h;
+        head = 0;
+        used = (size_t)n;
+    }
+    bool empty() const { return used == 0; }
+    int front() const { return slots[head]; }
+    void pop() {
+        head = (head + 1 == slots.size()) ? 0 : head + 1;
+        used--;
+    }
+    void push(int h) {
+        size_t tail = head + used;
+        if (tail >= slots.size()) tail -= slots.size();
+        slots[tail] = h;
+        used++;
+    }
+};
+
+// LIFO: a displaced hospital proposes again right away
+struct LifoStack {
+    static const char* name() { return "lifo"; }
+
+    std::vector<int> items;
+
+    void reset(int n) {
+        items.clear();
+        for (int h = n; h >= 1; h--) items.push_back(h);
+    }
+    bool empty() const { return items.empty(); }
+    int front() const { return items.back(); }
+    void pop() { items.pop_back(); }
+    void push(int h) { items.push_back(h); }
+};
+
+// uniformly random free hospital, reproducible from the seed
+struct RandomOrder {
+    static const char* name() { return "random"; }
+
+    std::vector<int> items;
+    std::mt19937 rng;
+    long long current = -1;     // position of front(), chosen lazily
+
+    explicit RandomOrder(unsigned seed = 1) : rng(seed) {}
+
+    void reset(int n) {
+        items.clear();
+        for (int h = 1; h <= n; h++) items.push_back(h);
+        current = -1;
+    }
+    bool empty() const { return items.empty(); }
+    int front() {
+        if (current < 0) current = (long long)(rng() % items.size());
+        return items[(size_t)current];
+    }
+    void pop() {
+        items[(size_t)current] = items.back();
+        items.pop_back();
+        current = -1;
+    }
+    void push(int h) { items.push_back(h); }
+};
+
+// per-round counters from MatchingEngine::solveRounds
+struct RoundStats {
+    long long proposals = 0;    // = hospitals free at the start of the round
+    long long accepted = 0;     // proposals that ended the round holding a student
+    double ms = 0;
+};
+
+// class for the Matching Engine
+template <class Index>
+class MatchingEngine
+{
+    unsigned int count;
+    Instance<Index> inst;
+    
+public:
+
+    // Expected # of hospitals and students must be assigned at creation
+
+    explicit MatchingEngine(unsigned int count) : count(count) {
+        inst.n = (int)count;
+        inst.hospPref.assign((int)count);
+        inst.studPref.assign((int)count);
+        inst.studRank.assign((int)count);
+    }
+
+    // Takes over an instance that readInstance/loadBinaryInstance already validated,
+    // so the tables are neither copied nor checked again
+
+    explicit MatchingEngine(Instance<Index>&& validated)
+        : count((unsigned)validated.n), inst(std::move(validated)) {}
+
+    const Instance<Index>& instance() const { return inst; }
+
+    // hands the tables back so the next instance can be read into them, and takes over
+    // that instance once it is validated; one engine and one set of tables (grown only
+    // when n grows) can then serve a stream of instances
+    Instance<Index> release() {
+        count = 0;
+        return std::move(inst);
+    }
+    void adopt(Instance<Index>&& validated) {
+        count = (unsigned)validated.n;
+        inst = std::move(validated);
+    }
+
+    void set_hospital_preferences(int hospital, const std::vector<int>& preferences) {
+        if ((unsigned)preferences.size() != count)
+            throw std::invalid_argument("Incorrect number of preferences (hospital).");
+        if (hospital < 1 || hospital > (int)count)
+            throw std::invalid_argument("Hospital id out of range.");
+        if (!isPermutation1toN(preferences, (int)count))
+            throw std::invalid_argument("Hospital preferences must be a permutation of 1..n.");
+
+        for (int k = 1; k <= (int)count; k++)
+            inst.hospPref[hospital][k] = (Index)preferences[k - 1];
+    }
+
+    void set_student_preferences(int student, const std::vector<int>& preferences) {
+        if ((unsigned)preferences.size() != count)
+            throw std::invalid_argument("Incorrect number of preferences (student).");
+        if (student < 1 || student > (int)count)
+            throw std::invalid_argument("Student id out of range.");
+        if (!isPermutation1toN(preferences, (int)count))
+            throw std::invalid_argument("Student preferences must be a permutation of 1..n.");
+
+        for (int k = 1; k <= (int)count; k++) {
+            int h = preferences[k - 1];
+            inst.studPref[student][k] = (Index)h;
+            inst.studRank[student][h] = (Index)k;
+        }
+    }
+
+    // new solve() approach
+    // returns hospital -> student mapping (1-indexed) and proposal count
+    // free hospitals are served in the order of the Schedule policy (see RingQueue)
+    // (uses the instance's myRankAt table when buildRankTable has filled it)
+    template <class Schedule = RingQueue>
+    std::pair<std::vector<Index>, long long> solve(Schedule unmatched_hospitals = Schedule()) {
+        if (inst.myRankAt.size() == inst.n && inst.n > 0)
+            return solveWith<true>(unmatched_hospitals);
+        return solveWith<false>(unmatched_hospitals);
+    }
+
+    // parallel McVitie-Wilson style solve(): each thread takes free hospitals from its own
+    // queue (stealing from the others when empty) and proposes down their lists.
+    // A student's state is one atomic word (rank << 32 | hospital, 0 = free) and an offer
+    // wins only by a compare-and-swap to a lower word, so students never accept a worse
+    // hospital. The displaced hospital goes back on the proposing thread's queue.
+    // Gale-Shapley yields the hospital-optimal matching in any proposal order, so the
+    // result is the same as solve().
+    std::pair<std::vector<Index>, long long> solveParallel(unsigned threads) {
+        threads = resolveThreads(threads);
+        bool ranked = inst.myRankAt.size() == inst.n && inst.n > 0;
+
+        struct WorkQueue {
+            std::mutex lock;
+            std::deque<int> hospitals;
+        };
+        std::vector<WorkQueue> queues(threads);
+        for (int h = 1; h <= (int)count; h++)
+            queues[(size_t)(h - 1) * threads / count].hospitals.push_back(h);
+
+        std::unique_ptr<std::atomic<uint64_t>[]> offers(new std::atomic<uint64_t>[count + 1]);
+        for (unsigned s = 0; s <= count; s++) offers[s].store(0, std::memory_order_relaxed);
+
+        // only the thread currently holding a hospital touches its next choice;
+        // the CAS that displaces it and the queue lock publish the value to the next holder
+        std::vector<int> next_choices(count + 1, 1);
+        std::atomic<long long> free_hospitals((long long)count);
+        std::atomic<long long> proposals(0);
+
+        runThreads(threads, [&](unsigned id) {
+            WorkQueue& own = queues[id];
+            long long my_proposals = 0;
+
+            auto take = [&](int& hospital) {
+                {
+                    std::lock_guard<std::mutex> guard(own.lock);
+                    if (!own.hospitals.empty()) {
+                        hospital = own.hospitals.back();
+                        own.hospitals.pop_back();
+                        return true;
+                    }
+                }
+                for (unsigned i = 1; i < threads; i++) {
+                    WorkQueue& victim = queues[(id + i) % threads];
+                    std::lock_guard<std::mutex> guard(victim.lock);
+                    if (!victim.hospitals.empty()) {
+                        hospital = victim.hospitals.front();
+                        victim.hospitals.pop_front();
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            while (free_hospitals.load(std::memory_order_acquire) > 0) {
+                int hospital;
+                if (!take(hospital)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                while (true) {
+                    int choice = next_choices[hospital];
+                    // in case of bad input (shouldn’t happen with complete lists)
+                    if (choice > (int)count) {
+                        free_hospitals.fetch_sub(1, std::memory_order_acq_rel);
+                        break;
+                    }
+                    next_choices[hospital] = choice + 1;
+                    my_proposals++;
+
+                    int student = inst.hospPref[hospital][choice];
+                    uint64_t rank = ranked ? inst.myRankAt[hospital][choice] : inst.studRank[student][hospital];
+                    uint64_t offer = (rank << 32) | (uint64_t)hospital;
+
+                    uint64_t current = offers[student].load(std::memory_order_acquire);
+                    bool accepted = false;
+                    while (current == 0 || offer < current) {
+                        if (offers[student].compare_exchange_weak(current, offer, std::memory_order_acq_rel)) {
+                            accepted = true;
+                            break;
+                        }
+                    }
+                    if (!accepted) continue;    // rejected; try the next choice
+
+                    if (current == 0) {
+                        // student was free -> one fewer free hospital
+                        free_hospitals.fetch_sub(1, std::memory_order_acq_rel);
+                    } else {
+                        // student switched; the previous hospital is free again
+                        std::lock_guard<std::mutex> guard(own.lock);
+                        own.hospitals.push_back((int)(current & 0xffffffffu));
+                    }
+                    break;
+                }
+            }
+            proposals.fetch_add(my_proposals, std::memory_order_relaxed);
+        });
+
+        std::vector<Index> hospital_matches(count + 1, 0);
+        for (int s = 1; s <= (int)count; s++) {
+            uint64_t offer = offers[s].load(std::memory_order_relaxed);
+            if (offer) hospital_matches[offer & 0xffffffffu] = (Index)s;
+        }
+        return {hospital_matches, proposals.load()};
+    }
+
+    // round-synchronous (bulk-synchronous) solve(): every round, each free hospital proposes
+    // to its next choice, every student keeps the best of its new offers and its current
+    // hospital, and the losers make up the next round's free list. Offers to a student are
+    // reduced in parallel with an atomic minimum over (rank << 32 | hospital) words.
+    // The rounds depend only on the instance, not on the thread count or timing, so the
+    // per-round counts in `stats` are reproducible run to run.
+    std::pair<std::vector<Index>, long long> solveRounds(unsigned threads, std::vector<RoundStats>* stats = nullptr) {
+        threads = resolveThreads(threads);
+        bool ranked = inst.myRankAt.size() == inst.n && inst.n > 0;
+
+        std::vector<int> free_hospitals, next_free;
+        for (int h = 1; h <= (int)count; h++) free_hospitals.push_back(h);
+        std::vector<int> next_choices(count + 1, 1);
+        std::vector<uint64_t> offers;                  // this round's offer by free_hospitals[i], 0 if none
+        std::vector<int> targets;                      // and the student it went to
+        std::vector<uint64_t> holding(count + 1, 0);   // student's current (rank << 32 | hospital)
+        std::unique_ptr<std::atomic<uint64_t>[]> best(new std::atomic<uint64_t>[count + 1]);
+        for (unsigned s = 0; s <= count; s++) best[s].store(0, std::memory_order_relaxed);
+
+        std::vector<std::vector<int>> losers(threads);      // per thread, in free-list order
+        std::vector<long long> accepted(threads, 0);
+        long long proposals = 0;
+        Barrier barrier(threads);
+        offers.resize(free_hospitals.size());
+        targets.resize(free_hospitals.size());
+        auto round_start = std::chrono::steady_clock::now();
+
+        runThreads(threads, [&](unsigned id) {
+            while (true) {
+                size_t total = free_hospitals.size();
+                if (total == 0) break;
+                auto [first, last] = threadRange(total, id, threads);
+
+                // 1: propose, keeping the lowest offer per student
+                for (size_t i = first; i < last; i++) {
+                    int hospital = free_hospitals[i];
+                    int choice = next_choices[hospital];
+                    // in case of bad input (shouldn’t happen with complete lists)
+                    if (choice > (int)count) {
+                        offers[i] = 0;
+                        continue;
+                    }
+                    next_choices[hospital] = choice + 1;
+
+                    int student = inst.hospPref[hospital][choice];
+                    uint64_t rank = ranked ? inst.myRankAt[hospital][choice] : inst.studRank[student][hospital];
+                    uint64_t offer = (rank << 32) | (uint64_t)hospital;
+                    offers[i] = offer;
+                    targets[i] = student;
+
+                    uint64_t current = best[student].load(std::memory_order_relaxed);
+                    while ((current == 0 || offer < current) &&
+                           !best[student].compare_exchange_weak(current, offer, std::memory_order_relaxed)) {}
+                }
+                barrier.wait();
+
+                // 2: each student's round winner competes with its current hospital
+                // (only the winner's thread touches holding[student])
+                losers[id].clear();
+                accepted[id] = 0;
+                for (size_t i = first; i < last; i++) {
+                    uint64_t offer = offers[i];
+                    if (offer == 0) continue;
+                    int student = targets[i];
+                    if (best[student].load(std::memory_order_relaxed) != offer) {
+                        losers[id].push_back(free_hospitals[i]);
+                        continue;
+                    }
+                    uint64_t current = holding[student];
+                    if (current == 0 || offer < current) {
+                        holding[student] = offer;
+                        accepted[id]++;
+                        if (current != 0) losers[id].push_back((int)(current & 0xffffffffu));
+                    } else {
+                        losers[id].push_back(free_hospitals[i]);
+                    }
+                }
+                barrier.wait();
+
+                // 3: clear this round's offers and build the next free list
+                for (size_t i = first; i < last; i++)
+                    if (offers[i]) best[targets[i]].store(0, std::memory_order_relaxed);
+                barrier.wait();
+
+                if (id == 0) {
+                    next_free.clear();
+                    long long round_accepted = 0;
+                    for (unsigned t = 0; t < threads; t++) {
+                        next_free.insert(next_free.end(), losers[t].begin(), losers[t].end());
+                        round_accepted += accepted[t];
+                    }
+                    // hospitals are served in id order each round, whatever the thread count
+                    std::sort(next_free.begin(), next_free.end());
+                    proposals += (long long)total;
+
+                    if (stats) {
+                        auto now = std::chrono::steady_clock::now();
+                        RoundStats round;
+                        round.proposals = (long long)total;
+                        round.accepted = round_accepted;
+                        round.ms = std::chrono::duration<double, std::milli>(now - round_start).count();
+                        stats->push_back(round);
+                        round_start = now;
+                    }
+
+                    std::swap(free_hospitals, next_free);
+                    offers.resize(free_hospitals.size());
+                    targets.resize(free_hospitals.size());
+                }
+                barrier.wait();
+            }
+        });
+
+        std::vector<Index> hospital_matches(count + 1, 0);
+        for (int s = 1; s <= (int)count; s++)
+            if (holding[s]) hospital_matches[holding[s] & 0xffffffffu] = (Index)s;
+        return {hospital_matches, proposals};
+    }
+
+    // latency-hiding solve(): up to `lanes` free hospitals are in flight at once, each a small
+    // state machine that prefetches what its next step reads and then yields to the other
+    // lanes, so the cache misses of several proposals overlap instead of running back to back.
+    //   stage 1: pick the student, prefetch its match and the proposer's rank at it
+    //   stage 2: read the current match, prefetch that hospital's rank at the student
+    //   stage 3: compare and resolve (re-reading the match, which other lanes may have changed)
+    // Same hospital-optimal result as solve(), only the proposal order differs.
+    std::pair<std::vector<Index>, long long> solveInterleaved(int lanes) {
+        if (inst.myRankAt.size() == inst.n && inst.n > 0)
+            return solveInterleaved<true>(lanes);
+        return solveInterleaved<false>(lanes);
+    }
+
+private:
+
+    template <bool Ranked>
+    std::pair<std::vector<Index>, long long> solveInterleaved(int lanes) {
+        struct Lane {
+            int hospital = 0;   // 0 = idle
+            int choice = 0;
+            int student = 0;
+            int stage = 0;
+        };
+        std::vector<Lane> lane(std::max(1, lanes));
+
+        std::vector<int> unmatched_hospitals;
+        for (int h = (int)count; h >= 1; h--) unmatched_hospitals.push_back(h);
+        std::vector<int> next_choices(count + 1, 1);
+        std::vector<Index> student_matches(count + 1, 0);
+        std::vector<Index> hospital_matches(count + 1, 0);
+        std::vector<Index> match_rank(Ranked ? count + 1 : 0, 0);
+
+        long long proposals = 0;
+        size_t busy = 0;
+
+        // stage 1 for lane l's hospital: its next proposal
+        auto propose = [&](Lane& l) {
+            // in case of bad input (shouldn’t happen with complete lists)
+            if (next_choices[l.hospital] > (int)count) {
+                l.hospital = 0;
+                busy--;
+                return;
+            }
+            l.choice = next_choices[l.hospital]++;
+            l.student = inst.hospPref[l.hospital][l.choice];
+            proposals++;
+            prefetch(&student_matches[l.student]);
+            if (Ranked) {
+                prefetch(&match_rank[l.student]);
+            } else {
+                prefetch(&inst.studRank[l.student][l.hospital]);
+            }
+            l.stage = Ranked ? 3 : 2;
+        };
+
+        auto accept = [&](Lane& l, int prev_hospital) {
+            student_matches[l.student] = (Index)l.hospital;
+            hospital_matches[l.hospital] = (Index)l.student;
+            if (Ranked) match_rank[l.student] = inst.myRankAt[l.hospital][l.choice];
+            if (prev_hospital) {
+                hospital_matches[prev_hospital] = 0;
+                unmatched_hospitals.push_back(prev_hospital);
+            }
+            l.hospital = 0;
+            busy--;
+        };
+
+        while (true) {
+            bool idle = true;
+            for (Lane& l : lane) {
+                if (l.hospital == 0) {
+                    if (unmatched_hospitals.empty()) continue;
+                    l.hospital = unmatched_hospitals.back();
+                    unmatched_hospitals.pop_back();
+                    busy++;
+                    propose(l);
+                    idle = false;
+                    continue;
+                }
+                idle = false;
+
+                if (l.stage == 2) {
+                    int prev_hospital = student_matches[l.student];
+                    if (prev_hospital) prefetch(&inst.studRank[l.student][prev_hospital]);
+                    l.stage = 3;
+                    continue;
+                }
+
+                int prev_hospital = student_matches[l.student];
+                bool prefers = prev_hospital == 0 || (Ranked
+                    ? inst.myRankAt[l.hospital][l.choice] < match_rank[l.student]
+                    : inst.studRank[l.student][l.hospital] < inst.studRank[l.student][prev_hospital]);
+                if (prefers)
+                    accept(l, prev_hospital);
+                else
+                    propose(l);     // rejected; same lane moves on to the next choice
+            }
+            if (idle && busy == 0) break;
+        }
+
+        return {hospital_matches, proposals};
+    }
+
+    // Ranked: compare myRankAt[h][k] against the rank the student gave its current
+    // hospital (kept in match_rank) instead of looking both up in studRank
+    template <bool Ranked, class Schedule>
+    std::pair<std::vector<Index>, long long> solveWith(Schedule& unmatched_hospitals) {
+        std::vector<int> next_choices(count + 1, 1);      // can reach n + 1, so kept as int
+        std::vector<Index> student_matches(count + 1, 0);
+        std::vector<Index> hospital_matches(count + 1, 0);
+        std::vector<Index> match_rank(Ranked ? count + 1 : 0, 0);
+
+        unmatched_hospitals.reset((int)count);
+
+        long long proposals = 0;
+
+        while (!unmatched_hospitals.empty()) {
+            int hospital = unmatched_hospitals.front();
+
+            // in case of bad input (shouldn’t happen with complete lists)
+            if (next_choices[hospital] > (int)count) {
+                unmatched_hospitals.pop();
+                continue;
+            }
+
+            int choice = next_choices[hospital];
+            int student = inst.hospPref[hospital][choice];
+            next_choices[hospital]++;
+            proposals++;
+
+            if (student_matches[student] == 0) {
+                // student free -> match
+                student_matches[student] = (Index)hospital;
+                hospital_matches[hospital] = (Index)student;
+                if (Ranked) match_rank[student] = inst.myRankAt[hospital][choice];
+                unmatched_hospitals.pop();
+            } else {
+                int prev_hospital = student_matches[student];
+
+                // student prefers lower rank
+                bool prefers = Ranked
+                    ? inst.myRankAt[hospital][choice] < match_rank[student]
+                    : inst.studRank[student][hospital] < inst.studRank[student][prev_hospital];
+                if (prefers) {
+                    // student switches
+                    student_matches[student] = (Index)hospital;
+                    hospital_matches[hospital] = (Index)student;
+                    if (Ranked) match_rank[student] = inst.myRankAt[hospital][choice];
+
+                    hospital_matches[prev_hospital] = 0;
+
+                    unmatched_hospitals.pop();
+                    unmatched_hospitals.push(prev_hospital);
+                }
+                // else rejected; hospital stays unmatched and tries again later
+            }
+        }
+
+        return {hospital_matches, proposals};
+    }
+
+public:
+    // student-proposing Gale-Shapley: returns the student-optimal matching as hospital ->
+    // student (1-indexed), the same shape as solve(), and the proposal count.
+    // Builds the instance's hospRank table first and otherwise only reads the tables, so it
+    // can run on another thread alongside solve() on the same engine.
+    std::pair<std::vector<Index>, long long> solveStudentOptimal() {
+        int n = (int)count;
+        inst.hospRank.assign(n);
+        for (int h = 1; h <= n; h++) {
+            auto prefs = inst.hospPref[h];
+            auto ranks = inst.hospRank[h];
+            for (int k = 1; k <= n; k++) ranks[prefs[k]] = (Index)k;
+        }
+
+        std::vector<int> next_choices(n + 1, 1);
+        std::vector<Index> student_matches(n + 1, 0);
+        std::vector<Index> hospital_matches(n + 1, 0);
+        RingQueue unmatched_students;
+        unmatched_students.reset(n);
+
+        long long proposals = 0;
+
+        while (!unmatched_students.empty()) {
+            int student = unmatched_students.front();
+            if (next_choices[student] > n) {
+                unmatched_students.pop();
+                continue;
+            }
+
+            int hospital = inst.studPref[student][next_choices[student]++];
+            proposals++;
+
+            int prev_student = hospital_matches[hospital];
+            if (prev_student == 0 || inst.hospRank[hospital][student] < inst.hospRank[hospital][prev_student]) {
+                // hospital free, or it prefers the new student
+                hospital_matches[hospital] = (Index)student;
+                student_matches[student] = (Index)hospital;
+                unmatched_students.pop();
+                if (prev_student) {
+                    student_matches[prev_student] = 0;
+                    unmatched_students.push(prev_student);
+                }
+            }
+            // else rejected; student stays unmatched and tries again later
+        }
+
+        return {hospital_matches, proposals};
+    }
+};
+
+// drops an engine's views of borrowed tables (shared memory, caller buffers), so they are
+// released once the request is done
+template <class Index>
+void dropBorrowedTables(MatchingEngine<Index>& engine) {
+    auto inst = engine.release();
+    if (inst.hospPref.borrowed()) inst.hospPref = Matrix<Index>();
+    if (inst.studPref.borrowed()) inst.studPref = Matrix<Index>();
+    engine.adopt(std::move(inst));
+}
+
+#ifdef MATCHING_X86_SIMD
+
+// The kernels below check a hospital's preference row for blocking pairs 8 (AVX2) or
+// 16 (AVX-512) entries at a time: for students s = prefs[k..], gather studRank[s][h]
+// and studRank[s][studToHosp[s]] and compare them. They stop at the chunk holding the
+// matched student and return how many entries they consumed; the scalar loop finishes
+// any tail shorter than a vector. `done` is set once the matched student was reached
+// or found() asked to stop. Gathers use 32-bit element offsets (see simdGatherFits);
+// 2-byte entries are gathered as 4 bytes and masked, which the table padding allows.
+
+template <class Index>
+__attribute__((target("avx2")))
+__m256i gatherAvx2(const Index* base, __m256i offsets) {
+    __m256i v = _mm256_i32gather_epi32((const int*)base, offsets, (int)sizeof(Index));
+    if (sizeof(Index) == 2) v = _mm256_and_si256(v, _mm256_set1_epi32(0xffff));
+    return v;
+}
+
+template <class Index, class Fn>
+__attribute__((target("avx2")))
+int scanBlockingAvx2(const Index* prefs, int n, int h, int sMatched, const Index* rank, int stride,
+                     const Index* studToHosp, Fn& found, bool& done) {
+    const __m256i matched = _mm256_set1_epi32(sMatched);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i strideV = _mm256_set1_epi32(stride);
+    const __m256i column = _mm256_set1_epi32(h - 1);
+
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256i s;
+        if (sizeof(Index) == 2)
+            s = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(prefs + k)));
+        else
+            s = _mm256_loadu_si256((const __m256i*)(prefs + k));
+
+        unsigned stop = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(s, matched)));
+        __m256i row = _mm256_mullo_epi32(_mm256_sub_epi32(s, one), strideV);
+        __m256i rankH = gatherAvx2(rank, _mm256_add_epi32(row, column));
+        __m256i other = gatherAvx2(studToHosp, s);
+        __m256i rankOther = gatherAvx2(rank, _mm256_add_epi32(row, _mm256_sub_epi32(other, one)));
+        unsigned blocking = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(rankOther, rankH)));
+
+        if (stop) blocking &= (1u << __builtin_ctz(stop)) - 1;
+        for (; blocking; blocking &= blocking - 1) {
+            if (!found((int)prefs[k + __builtin_ctz(blocking)])) {
+                done = true;
+                return k;
+            }
+        }
+        if (stop) {
+            done = true;
+            return k;
+        }
+    }
+    return k;
+}
+
+template <class Index>
+__attribute__((target("avx512f")))
+__m512i gatherAvx512(const Index* base, __m512i offsets) {
+    __m512i v = _mm512_i32gather_epi32(offsets, (const void*)base, (int)sizeof(Index));
+    if (sizeof(Index) == 2) v = _mm512_and_si512(v, _mm512_set1_epi32(0xffff));
+    return v;
+}
+
+template <class Index, class Fn>
+__attribute__((target("avx512f")))
+int scanBlockingAvx512(const Index* prefs, int n, int h, int sMatched, const Index* rank, int stride,
+                       const Index* studToHosp, Fn& found, bool& done) {
+    const __m512i matched = _mm512_set1_epi32(sMatched);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i strideV = _mm512_set1_epi32(stride);
+    const __m512i column = _mm512_set1_epi32(h - 1);
+
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512i s;
+        if (sizeof(Index) == 2)
+            s = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(prefs + k)));
+        else
+            s = _mm512_loadu_si512((const void*)(prefs + k));
+
+        unsigned stop = _mm512_cmpeq_epi32_mask(s, matched);
+        __m512i row = _mm512_mullo_epi32(_mm512_sub_epi32(s, one), strideV);
+        __m512i rankH = gatherAvx512(rank, _mm512_add_epi32(row, column));
+        __m512i other = gatherAvx512(studToHosp, s);
+        __m512i rankOther = gatherAvx512(rank, _mm512_add_epi32(row, _mm512_sub_epi32(other, one)));
+        unsigned blocking = _mm512_cmpgt_epi32_mask(rankOther, rankH);
+
+        if (stop) blocking &= (1u << __builtin_ctz(stop)) - 1;
+        for (; blocking; blocking &= blocking - 1) {
+            if (!found((int)prefs[k + __builtin_ctz(blocking)])) {
+                done = true;
+                return k;
+            }
+        }
+        if (stop) {
+            done = true;
+            return k;
+        }
+    }
+    return k;
+}
+
+#endif
+
+// the kernels address studRank with 32-bit element offsets and rely on its padding
+template <class Index>
+bool simdGatherFits(const Instance<Index>& inst) {
+    return !inst.studRank.borrowed() && (double)inst.n * (double)inst.studRank.stride() < 2147483647.0;
+}
+
+// calls found(s) for each student s before h's match in h's list that prefers h to its
+// own match, in list order, until found returns false
+// (h's list is scanned only up to its matched student; vectorized when simdLevel() allows)
+template <class Index, class Fn>
+void scanBlockingStudents(const Instance<Index>& inst, int h, const std::vector<Index>& hospToStud,
+                          const std::vector<Index>& studToHosp, Fn found) {
+    int sMatched = hospToStud[h];
+    auto prefs = inst.hospPref[h];
+    int k = 1;
+
+#ifdef MATCHING_X86_SIMD
+    // most prefixes are short, so the first entries go through the scalar loop below
+    const int scalarHead = 16;
+    SimdLevel level = simdLevel();
+    if (level != SimdLevel::Scalar && inst.n > scalarHead && studToHosp.size() > (size_t)inst.n + 1 &&
+        simdGatherFits(inst)) {
+        for (; k <= scalarHead; k++) {
+            int s = prefs[k];
+            if (s == sMatched) return;
+            if (inst.studRank[s][h] < inst.studRank[s][studToHosp[s]] && !found(s)) return;
+        }
+
+        bool done = false;
+        int stride = (int)inst.studRank.stride();
+        const Index* rest = prefs.begin() + scalarHead;
+        if (level == SimdLevel::Avx512)
+            k += scanBlockingAvx512(rest, inst.n - scalarHead, h, sMatched, inst.studRank.data(), stride,
+                                    studToHosp.data(), found, done);
+        else
+            k += scanBlockingAvx2(rest, inst.n - scalarHead, h, sMatched, inst.studRank.data(), stride,
+                                  studToHosp.data(), found, done);
+        if (done) return;
+    }
+#endif
+
+    for (; (int)prefs[k] != sMatched; k++) {
+        int s = prefs[k];
+        int hMatchedToS = studToHosp[s];
+        if (inst.studRank[s][h] < inst.studRank[s][hMatchedToS])
+            if (!found(s)) return;
+    }
+}
+
+// first student that forms a blocking pair with h, or 0
+template <class Index>
+int firstBlockingStudent(const Instance<Index>& inst, int h, const std::vector<Index>& hospToStud,
+                         const std::vector<Index>& studToHosp) {
+    int first = 0;
+    scanBlockingStudents(inst, h, hospToStud, studToHosp, [&](int s) {
+        first = s;
+        return false;
+    });
+    return first;
+}
+
+// lowest hospital with a blocking pair and its first blocking student, or {0, 0}.
+// Threads take consecutive ranges of hospitals in increasing order and stop once a
+// blocking pair has been found below their range, so the answer matches the serial scan.
+template <class Index>
+std::pair<int, int> findBlockingPair(const Instance<Index>& inst, const std::vector<Index>& hospToStud,
+                                     const std::vector<Index>& studToHosp, unsigned threads) {
+    int n = inst.n;
+    threads = resolveThreads(threads);
+    if (threads == 1) {
+        for (int h = 1; h <= n; h++)
+            if (int s = firstBlockingStudent(inst, h, hospToStud, studToHosp)) return {h, s};
+        return {0, 0};
+    }
+
+    const int chunk = 256;
+    std::atomic<int> nextHospital(1);
+    std::atomic<int> firstBlocked(n + 1);    // lowest hospital known to be in a blocking pair
+    std::mutex found;
+    std::pair<int, int> blocking = {0, 0};
+
+    runThreads(threads, [&](unsigned) {
+        while (true) {
+            int start = nextHospital.fetch_add(chunk, std::memory_order_relaxed);
+            if (start > n || start >= firstBlocked.load(std::memory_order_relaxed)) break;
+            int last = std::min(n, start + chunk - 1);
+            for (int h = start; h <= last; h++) {
+                if (h >= firstBlocked.load(std::memory_order_relaxed)) break;
+                int s = firstBlockingStudent(inst, h, hospToStud, studToHosp);
+                if (!s) continue;
+
+                std::lock_guard<std::mutex> guard(found);
+                if (blocking.first == 0 || h < blocking.first) {
+                    blocking = {h, s};
+                    firstBlocked.store(h, std::memory_order_relaxed);
+                }
+                break;
+            }
+        }
+    });
+    return blocking;
+}
+
+// checks that pairs is a perfect matching and fills both directions of it;
+// returns the INVALID message, or "" if it is one
+template <class Index>
+std::string checkMatching(int n, const std::vector<std::pair<int,int>>& pairs, std::vector<Index>& hospToStud,
+                          std::vector<Index>& studToHosp) {
+    if ((int)pairs.size() != n) {
+        return "INVALID: expected " + std::to_string(n) + " matching lines, got " + std::to_string(pairs.size());
+    }
+
+    // (one spare entry so SIMD gathers of studToHosp[n] stay in bounds)
+    hospToStud.assign(n + 2, 0);
+    studToHosp.assign(n + 2, 0);
+    std::vector<char> seenHosp(n + 1, 0), seenStud(n + 1, 0);
+
+    // validity
+    for (auto [h, s] : pairs) {
+        if (h < 1 || h > n || s < 1 || s > n)
+            return "INVALID: out-of-range pair (" + std::to_string(h) + "," + std::to_string(s) + ")";
+        if (seenHosp[h]) return "INVALID: hospital " + std::to_string(h) + " appears more than once";
+        if (seenStud[s]) return "INVALID: student " + std::to_string(s) + " appears more than once";
+        seenHosp[h] = 1; seenStud[s] = 1;
+        hospToStud[h] = (Index)s;
+        studToHosp[s] = (Index)h;
+    }
+    for (int h = 1; h <= n; h++) if (!seenHosp[h]) return "INVALID: hospital " + std::to_string(h) + " is unmatched";
+    for (int s = 1; s <= n; s++) if (!seenStud[s]) return "INVALID: student " + std::to_string(s) + " is unmatched";
+    return "";
+}
+
+// Verifier (done as a separate mode rather than a separate program. could be changed later)
+template <class Index>
+std::string verifyMatching(const Instance<Index>& inst, const std::vector<std::pair<int,int>>& pairs,
+                           unsigned threads = 1) {
+    std::vector<Index> hospToStud, studToHosp;
+
+    // validity
+    std::string invalid = checkMatching(inst.n, pairs, hospToStud, studToHosp);
+    if (!invalid.empty()) return invalid;
+
+    // stability (blocking pair)
+    // each hospital's list is scanned only up to its matched student, so the work is the
+    // sum of the matched ranks and nothing beyond O(n) is allocated
+    auto [h, s] = findBlockingPair(inst, hospToStud, studToHosp, threads);
+    if (h)
+        return "UNSTABLE: blocking pair (hospital " + std::to_string(h) + ", student " + std::to_string(s) + ")";
+
+    return "VALID STABLE";
+}
+
+// verify --all: writes every blocking pair as "hospital student" lines to pairsOut
+// (by hospital, then in the hospital's list order) and a per-hospital count summary to
+// summaryOut; returns the number of blocking pairs, or -1 if the matching is invalid.
+// Hospitals are scanned in blocks on all threads; a wave of blocks is formatted in
+// parallel and then written in order, so output is the same for any thread count.
+template <class Index>
+long long verifyAllBlockingPairs(const Instance<Index>& inst, const std::vector<std::pair<int,int>>& pairs,
+                                 unsigned threads, std::ostream& pairsOut, std::ostream& summaryOut) {
+    int n = inst.n;
+    std::vector<Index> hospToStud, studToHosp;
+    std::string invalid = checkMatching(n, pairs, hospToStud, studToHosp);
+    if (!invalid.empty()) {
+        summaryOut << invalid << "\n";
+        return -1;
+    }
+
+    threads = resolveThreads(threads);
+    const int block = 16;
+    const int wave = block * 4 * (int)threads;
+    std::vector<long long> counts(n + 1, 0);
+    std::vector<std::string> formatted((wave + block - 1) / block);
+    BufferedWriter writer(pairsOut);
+
+    for (int waveStart = 1; waveStart <= n; waveStart += wave) {
+        int waveEnd = std::min(n, waveStart + wave - 1);
+        int blocks = (waveEnd - waveStart) / block + 1;
+        std::atomic<int> nextBlock(0);
+
+        runThreads(threads, [&](unsigned) {
+            for (int b; (b = nextBlock.fetch_add(1, std::memory_order_relaxed)) < blocks;) {
+                std::string& out = formatted[b];
+                out.clear();
+                int first = waveStart + b * block;
+                int last = std::min(waveEnd, first + block - 1);
+                for (int h = first; h <= last; h++) {
+                    scanBlockingStudents(inst, h, hospToStud, studToHosp, [&](int s) {
+                        appendInt(out, h);
+                        out.push_back(' ');
+                        appendInt(out, s);
+                        out.push_back('\n');
+                        counts[h]++;
+                        return true;
+                    });
+                }
+            }
+        });
+
+        for (int b = 0; b < blocks; b++) writer.write(formatted[b]);
+    }
+    writer.flush();
+
+    long long total = 0;
+    for (int h = 1; h <= n; h++) {
+        if (!counts[h]) continue;
+        summaryOut << "hospital " << h << ": " << counts[h] << " blocking pairs\n";
+        total += counts[h];
+    }
+    if (total == 0)
+        summaryOut << "VALID STABLE\n";
+    else
+        summaryOut << "UNSTABLE: " << total << " blocking pairs\n";
+    return total;
+}
+
+template <class Reader>
+std::vector<std::pair<int,int>> readMatchingPairs(Reader& in) {
+    std::vector<std::pair<int,int>> pairs;
+    const size_t CHUNK = 1024;  // even, so no pair straddles two chunks
+    int values[CHUNK];
+    size_t read;
+    do {
+        read = in.next(values, CHUNK);
+        for (size_t i = 0; i + 1 < read; i += 2) pairs.push_back({values[i], values[i + 1]});
+    } while (read == CHUNK);
+    return pairs;
+}
+
+// reads the 2n preference rows of a mapped text instance on several threads when
+// each row sits on its own line: line boundaries are found first, then every thread
+// parses, validates and ranks a range of rows. The first failing row is reported if it
+// is merely not a permutation; a row that is not exactly n integers on its own line,
+// or a missing row, falls back to readInstance() so the error is the sequential one
+template <class Index>
+bool readInstanceParallel(BufferReader& in, int n, Instance<Index>& inst, std::string& err, unsigned threads) {
+    size_t rows = 2 * (size_t)n;
+    threads = (unsigned)std::min<size_t>(resolveThreads(threads), rows);
+    if (threads <= 1) return readInstance(in, n, inst, err);
+
+    auto lineEnd = [&](const char* p) {
+        const char* eol = (const char*)memchr(p, '\n', in.end - p);
+        return eol ? eol : in.end;
+    };
+
+    // [begin, end) of each non-blank line after the one holding n
+    std::vector<std::pair<const char*, const char*>> lines;
+    lines.reserve(rows);
+    const char* p = lineEnd(in.p);
+    if (!BufferReader(in.p, p - in.p).atEnd()) return readInstance(in, n, inst, err);
+    while (p < in.end && lines.size() < rows) {
+        const char* begin = p + 1;
+        p = lineEnd(begin);
+        if (!BufferReader(begin, p - begin).atEnd()) lines.push_back({begin, p});
+    }
+    if (lines.size() < rows) return readInstance(in, n, inst, err);
+
+    inst.n = n;
+    inst.hospPref.assign(n);
+    inst.studPref.assign(n);
+    inst.studRank.assign(n);
+
+    // first failing row of each thread's range (rows if none), and whether it was malformed
+    std::vector<size_t> firstBad(threads, rows);
+    std::vector<char> malformed(threads, 0);
+
+    runThreads(threads, [&](unsigned id) {
+        RowChecker check(n);
+        auto [from, to] = threadRange(rows, id, threads);
+        for (size_t r = from; r < to; r++) {
+            bool student = r >= (size_t)n;
+            int i = (int)(student ? r - n : r) + 1;
+            BufferReader line(lines[r].first, lines[r].second - lines[r].first);
+            bool valid;
+            if (student)
+                malformed[id] = !readRow(line, n, check, inst.studPref[i], &inst.studRank[i][1], valid);
+            else
+                malformed[id] = !readRow(line, n, check, inst.hospPref[i], (Index*)nullptr, valid);
+            if (!malformed[id] && !line.atEnd()) malformed[id] = 1;
+            if (malformed[id] || !valid) {
+                firstBad[id] = r;
+                return;
+            }
+        }
+    });
+
+    // ranges are in row order, so the first thread with a failure has the first failing row
+    for (unsigned id = 0; id < threads; id++) {
+        size_t r = firstBad[id];
+        if (r == rows) continue;
+        if (malformed[id]) return readInstance(in, n, inst, err);
+        if (r < (size_t)n)
+            err = "INVALID_HOSPITAL_PREF_LINE_" + std::to_string(r + 1);
+        else
+            err = "INVALID_STUDENT_PREF_LINE_" + std::to_string(r - n + 1);
+        return false;
+    }
+    in.p = lines.back().second;
+    return true;
+}
+
+// loads an instance from a text or binary file, or from text on stdin for "*",
+// and calls fn(inst) with an Instance<Index> of the width chosen for it
+// (sets binary if the file was in the binary format; text files are parsed on `threads` threads)
+template <class Fn>
+bool withInstance(const std::string& file, std::string& err, Fn fn, bool* binary = nullptr, unsigned threads = 1) {
+    if (binary) *binary = false;
+
+    // text instances pick the index width from n
+    auto fromText = [&](auto& reader) {
+        int n;
+        if (!readInstanceSize(reader, n, err)) return false;
+        bool ok = false;
+        withIndexType(n, [&](auto index) {
+            Instance<decltype(index)> inst;
+            if constexpr (std::is_same_v<std::decay_t<decltype(reader)>, BufferReader>)
+                ok = readInstanceParallel(reader, n, inst, err, threads);
+            else
+                ok = readInstance(reader, n, inst, err);
+            if (ok) fn(inst);
+        });
+        return ok;
+    };
+
+    if (file == "*") {
+        StreamReader reader{std::cin};
+        return fromText(reader);
+    }
+
+    // a missing file reads as empty, same as a failed ifstream
+    // (binary files stay mapped for as long as the Instance views them)
+    auto mapped = std::make_shared<MappedFile>();
+    mapped->open(file);
+    if (!isBinaryInstance(mapped->data(), mapped->size())) {
+        BufferReader reader(mapped->data(), mapped->size());
+        return fromText(reader);
+    }
+
+    // binary instances use their stored width so the matrices can be viewed in place
+    if (binary) *binary = true;
+    BinaryHeader header;
+    if (!readBinaryHeader(mapped->data(), mapped->size(), header, err)) return false;
+    auto fromBinary = [&](auto index) {
+        Instance<decltype(index)> inst;
+        if (!loadBinaryInstance(mapped->data(), header, inst, err, mapped)) return false;
+        fn(inst);
+        return true;
+    };
+    return (header.width == 2) ? fromBinary(uint16_t{}) : fromBinary(uint32_t{});
+}
+
+// calls fn with a token reader over the given file (see MappedFile), or over stdin for "*"
+template <class Fn>
+auto withReader(const std::string& file, Fn fn) {
+    if (file == "*") {
+        StreamReader reader{std::cin};
+        return fn(reader);
+    }
+    // a missing file reads as empty, same as a failed ifstream
+    MappedFile mapped;
+    mapped.open(file);
+    BufferReader reader(mapped.data(), mapped.size());
+    return fn(reader);
+}
+
+#endif